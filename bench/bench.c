@@ -0,0 +1,540 @@
+/*
+ * Copyright (c) 2015 Scarletts <scarlett@entering.space>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Builds a synthetic site with pswg in each parser mode and with each
+ * combination of aggregate outputs, and prints what each build cost as
+ * tab-separated values, one build per line:
+ *
+ *	mode flags pages build run wall user sys maxrss procs pages_per_sec
+ *
+ * where build is "full" from scratch or "noop" when nothing changed,
+ * times are in seconds, maxrss in kilobytes, and procs the processes
+ * started on the whole system during the build, pswg included (so keep
+ * it otherwise idle), or "-" where that can't be found out.
+ *
+ * The site is generated from a seed, so the same arguments give the same
+ * site every time. It has -n pages (1000) in directories up to -d deep
+ * (3), with bodies of -s bytes (4096) on average but some much longer,
+ * and -i percent of them (10) named index. Each build is run -r times
+ * (3), in the directory given by -w (bench-site), which is replaced.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE	/* wait4() */
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+
+#include "../xalloc.h"
+#include "../buf.h"
+
+#define MARKER		".pswg-bench"
+#define FANOUT		8
+#define YEARS		10
+
+struct params {
+	size_t pages;
+	size_t depth;
+	size_t body_size;	/* mean */
+	unsigned int index_share;	/* percent */
+	size_t runs;
+	uint64_t seed;
+	const char *dir;
+};
+
+struct mode {
+	const char *name;
+	const char *flag;	/* -p, -P or -m, NULL for the default parser */
+	const char *parser;	/* %s is the shim, NULL for none */
+};
+
+static const struct mode modes[] = {
+	{ "cat", NULL, NULL },
+	{ "spawn", "-p", "/bin/cat" },
+	{ "coproc", "-P", "%s /bin/cat" },
+	{ "markdown", "-m", NULL },
+};
+
+static const char *const flagsets[][6] = {
+	{ NULL },
+	{ "-a", NULL },
+	{ "-f", "-t", "bench", NULL },
+	{ "-n", NULL },
+	{ "-a", "-f", "-n", "-t", "bench", NULL },
+};
+
+static const char *const words[] = {
+	"pony", "static", "website", "generator", "page", "archive",
+	"feed", "news", "the", "a", "of", "and", "to", "in", "is",
+	"<em>small</em>", "&amp;", "POSIX", "template", "build",
+};
+
+static const char header[] = "<!DOCTYPE html>\n<html>\n<head>\n"
+    "<title>${title}</title>\n</head>\n<body>\n"
+    "<p>By ${owner}, created ${created_readable}</p>\n";
+
+static const char footer[] = "<p>Modified ${modified_readable}</p>\n"
+    "</body>\n</html>\n";
+
+static uint64_t rng;
+
+/* xorshift64*, the same everywhere for a given seed */
+static uint64_t
+next_random(void)
+{
+	rng ^= rng >> 12;
+	rng ^= rng << 25;
+	rng ^= rng >> 27;
+	return rng * UINT64_C(2685821657736338717);
+}
+
+static size_t
+random_below(size_t n)
+{
+	return (size_t)(next_random() % n);
+}
+
+/* Exponentially distributed around mean: mostly small, some large */
+static size_t
+random_size(size_t mean)
+{
+	double u = (double)(next_random() >> 11) / (double)(UINT64_C(1) << 53);
+	double size = -log(1.0 - u) * (double)mean;
+
+	return size < 64 ? 64 : (size_t)size;
+}
+
+static int
+run(char *const args[], bool quiet, struct rusage *ru)
+{
+	pid_t pid;
+	int status;
+	int fd;
+
+	if ((pid = fork()) == -1) {
+		perror("fork");
+		return -1;
+	}
+	if (pid == 0) {
+		if (quiet && (fd = open("/dev/null", O_WRONLY)) != -1) {
+			dup2(fd, STDOUT_FILENO);
+			dup2(fd, STDERR_FILENO);
+			close(fd);
+		}
+		execvp(args[0], args);
+		perror(args[0]);
+		_exit(127);
+	}
+	while (wait4(pid, &status, 0, ru) == -1) {
+		if (errno != EINTR) {
+			perror("wait4");
+			return -1;
+		}
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "%s failed\n", args[0]);
+		return -1;
+	}
+	return 0;
+}
+
+static int
+remove_tree(const char *path)
+{
+	char *args[] = { "rm", "-rf", (char *)path, NULL };
+	struct rusage ru;
+
+	return run(args, false, &ru);
+}
+
+static int
+write_file(const char *path, const char *data, size_t len, bool exclusive)
+{
+	int fd;
+	ssize_t ret;
+
+	fd = open(path, O_WRONLY | O_CREAT | (exclusive ? O_EXCL : O_TRUNC),
+	    0644);
+	if (fd == -1) {
+		if (errno != EEXIST) perror(path);
+		return -1;
+	}
+	while (len > 0) {
+		if ((ret = write(fd, data, len)) == -1) {
+			if (errno == EINTR) continue;
+			perror(path);
+			close(fd);
+			return -1;
+		}
+		data += ret;
+		len -= (size_t)ret;
+	}
+	return close(fd);
+}
+
+static void
+make_body(struct buf *b, size_t size)
+{
+	b->len = 0;
+	while (b->len < size) {
+		size_t n = 8 + random_size(40);
+
+		buf_appends(b, "<p>");
+		for (size_t i = 0; i < n; ++i) {
+			buf_appends(b, words[random_size(4) %
+			    (sizeof(words) / sizeof(words[0]))]);
+			buf_appends(b, i + 1 < n ? " " : ".</p>\n");
+		}
+	}
+}
+
+static int
+make_dirs(char *path)
+{
+	for (char *p = path + 1; *p != '\0'; ++p) {
+		if (*p != '/') continue;
+		*p = '\0';
+		if (mkdir(path, 0755) == -1 && errno != EEXIST) {
+			perror(path);
+			return -1;
+		}
+		*p = '/';
+	}
+	return 0;
+}
+
+/* Returns the number of pages made, or 0 on failure */
+static size_t
+generate(const struct params *prm)
+{
+	struct buf path = {0};
+	struct buf body = {0};
+	struct buf dates = {0};
+	size_t made = 0;
+	time_t now = time(NULL);
+
+	if (access(prm->dir, F_OK) == 0) {
+		buf_appendf(&path, "%s/" MARKER, prm->dir);
+		if (access(path.data, F_OK) == -1) {
+			fprintf(stderr, "%s exists, but isn't a site made by "
+			    "pswg-bench; not removing it\n", prm->dir);
+			goto end;
+		}
+		if (remove_tree(prm->dir) == -1) goto end;
+	}
+	if (mkdir(prm->dir, 0755) == -1 || chdir(prm->dir) == -1) {
+		perror(prm->dir);
+		goto end;
+	}
+
+	if (write_file(MARKER, "", 0, false) == -1 ||
+	    write_file("header.html", header, sizeof(header) - 1,
+	    false) == -1 ||
+	    write_file("footer.html", footer, sizeof(footer) - 1,
+	    false) == -1 ||
+	    mkdir("src", 0755) == -1) {
+		goto end;
+	}
+
+	rng = prm->seed == 0 ? 1 : prm->seed;
+	for (size_t i = 0; i < prm->pages; ++i) {
+		size_t depth = random_below(prm->depth + 1);
+		size_t dir_len;
+
+		path.len = 0;
+		buf_appends(&path, "src");
+		for (size_t d = 0; d < depth; ++d) {
+			buf_appendf(&path, "/d%zu", random_below(FANOUT));
+		}
+		buf_appends(&path, "/");
+		dir_len = path.len;
+		if (make_dirs(path.data) == -1) goto end;
+
+		make_body(&body, random_size(prm->body_size));
+		if (random_below(100) < prm->index_share) {
+			buf_appends(&path, "index.html");
+			if (write_file(path.data, body.data, body.len,
+			    true) == 0) {
+				goto made;
+			}
+			if (errno != EEXIST) goto end;
+			path.len = dir_len;
+		}
+		buf_appendf(&path, "page-%zu.html", i);
+		if (write_file(path.data, body.data, body.len, true) == -1) {
+			goto end;
+		}
+made:
+		buf_appendf(&dates, "%s\t%lld\n", path.data + sizeof("src"),
+		    (long long)(now - (time_t)random_below(YEARS * 365) *
+		    86400));
+		++made;
+	}
+	if (write_file("pswg.dates", dates.data, dates.len, false) == -1) {
+		made = 0;
+	}
+
+end:
+	buf_free(&path);
+	buf_free(&body);
+	buf_free(&dates);
+	return made;
+}
+
+/* Processes started so far on this system, or -1 if unknown */
+static long long
+process_count(void)
+{
+	FILE *fp;
+	char line[256];
+	long long count = -1;
+
+	if ((fp = fopen("/proc/stat", "r")) == NULL) return -1;
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (sscanf(line, "processes %lld", &count) == 1) break;
+	}
+	fclose(fp);
+	return count;
+}
+
+static double
+seconds(const struct timeval *tv)
+{
+	return (double)tv->tv_sec + (double)tv->tv_usec / 1e6;
+}
+
+static int
+measure(char *const args[], const struct mode *m, const char *flags,
+    size_t pages, const char *build, size_t r)
+{
+	struct timespec start, end;
+	struct rusage ru;
+	long long procs_before, procs_after;
+	double wall;
+
+	procs_before = process_count();
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (run(args, true, &ru) == -1) {
+		return -1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	procs_after = process_count();
+
+	wall = (double)(end.tv_sec - start.tv_sec) +
+	    (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("%s\t%s\t%zu\t%s\t%zu\t%.3f\t%.3f\t%.3f\t%ld\t", m->name,
+	    flags, pages, build, r, wall, seconds(&ru.ru_utime),
+	    seconds(&ru.ru_stime), (long)ru.ru_maxrss);
+	if (procs_before == -1 || procs_after == -1) {
+		printf("-");
+	} else {
+		printf("%lld", procs_after - procs_before);
+	}
+	printf("\t%.1f\n", wall > 0 ? (double)pages / wall : 0.0);
+	fflush(stdout);
+	return 0;
+}
+
+static int
+bench(const struct params *prm, size_t pages, const char *pswg,
+    const char *shim)
+{
+	char *args[16];
+	char *parser = NULL;
+	char flags[32];
+	int ret = 0;
+
+	for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]) && ret == 0;
+	    ++i) {
+		const struct mode *m = &modes[i];
+
+		free(parser);
+		parser = NULL;
+		if (m->parser != NULL) {
+			xasprintf(&parser, m->parser, shim);
+		}
+
+		for (size_t j = 0; j < sizeof(flagsets) / sizeof(flagsets[0]) &&
+		    ret == 0; ++j) {
+			size_t n = 0;
+
+			args[n++] = (char *)pswg;
+			if (m->flag != NULL) {
+				args[n++] = (char *)m->flag;
+			}
+			if (parser != NULL) {
+				args[n++] = parser;
+			}
+			flags[0] = '\0';
+			for (size_t k = 0; flagsets[j][k] != NULL; ++k) {
+				args[n++] = (char *)flagsets[j][k];
+				if (flagsets[j][k][0] == '-' &&
+				    strcmp(flagsets[j][k], "-t") != 0) {
+					strcat(flags, flagsets[j][k] + 1);
+				}
+			}
+			args[n] = NULL;
+			if (flags[0] == '\0') strcpy(flags, "-");
+
+			for (size_t r = 1; r <= prm->runs && ret == 0; ++r) {
+				if (remove_tree("build") == -1 ||
+				    measure(args, m, flags, pages, "full",
+				    r) == -1 ||
+				    measure(args, m, flags, pages, "noop",
+				    r) == -1) {
+					ret = -1;
+				}
+			}
+		}
+	}
+	free(parser);
+	return ret;
+}
+
+static int
+parse_size(const char *str, size_t *out)
+{
+	char *end;
+	unsigned long long n;
+
+	errno = 0;
+	n = strtoull(str, &end, 10);
+	if (errno != 0 || *end != '\0' || *str == '-' || *str == '\0' ||
+	    n > SIZE_MAX) {
+		fprintf(stderr, "invalid number: %s\n", str);
+		return -1;
+	}
+	*out = (size_t)n;
+	return 0;
+}
+
+static void
+usage(const char *program)
+{
+	fprintf(stderr, "usage: %s [-d depth] [-i index_percent] "
+	    "[-n pages] [-r runs] [-s body_size] [-S seed] [-w dir] "
+	    "pswg pswg-coproc\n", program);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct params prm = {
+		.pages = 1000,
+		.depth = 3,
+		.body_size = 4096,
+		.index_share = 10,
+		.runs = 3,
+		.seed = 1,
+		.dir = "bench-site",
+	};
+	size_t n;
+	size_t pages;
+	char *pswg, *shim;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "d:i:n:r:s:S:w:")) != -1) {
+		switch (ch) {
+			case 'd':
+				if (parse_size(optarg, &prm.depth) == -1) {
+					return 1;
+				}
+				break;
+			case 'i':
+				if (parse_size(optarg, &n) == -1) return 1;
+				if (n > 100) {
+					fprintf(stderr, "-i is a percentage\n");
+					return 1;
+				}
+				prm.index_share = (unsigned int)n;
+				break;
+			case 'n':
+				if (parse_size(optarg, &prm.pages) == -1) {
+					return 1;
+				}
+				break;
+			case 'r':
+				if (parse_size(optarg, &prm.runs) == -1) {
+					return 1;
+				}
+				break;
+			case 's':
+				if (parse_size(optarg, &prm.body_size) == -1) {
+					return 1;
+				}
+				break;
+			case 'S':
+				if (parse_size(optarg, &n) == -1) return 1;
+				prm.seed = n;
+				break;
+			case 'w':
+				prm.dir = optarg;
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+	if (argc - optind != 2) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	/* both are run from inside the site */
+	if ((pswg = realpath(argv[optind], NULL)) == NULL ||
+	    (shim = realpath(argv[optind + 1], NULL)) == NULL) {
+		perror("realpath");
+		return 1;
+	}
+
+	if ((pages = generate(&prm)) == 0) {
+		fprintf(stderr, "couldn't generate the site\n");
+		return 1;
+	}
+
+	printf("# pages=%zu depth=%zu body_size=%zu index=%u%% seed=%llu\n",
+	    pages, prm.depth, prm.body_size, prm.index_share,
+	    (unsigned long long)prm.seed);
+	printf("mode\tflags\tpages\tbuild\trun\twall\tuser\tsys\tmaxrss\t"
+	    "procs\tpages_per_sec\n");
+	fflush(stdout);
+
+	if (bench(&prm, pages, pswg, shim) == -1) {
+		fprintf(stderr, "a build failed, run it in %s to see why\n",
+		    prm.dir);
+		free(pswg);
+		free(shim);
+		return 1;
+	}
+	free(pswg);
+	free(shim);
+	return 0;
+}
@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2015 Scarletts <scarlett@entering.space>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "xalloc.h"
+#include "buf.h"
+
+/*
+ * hint is how much is expected to end up in the buffer, if known (e.g.
+ * from st_size), so that it can be allocated in one go.
+ */
+void
+buf_init(struct buf *b, size_t hint)
+{
+	b->size = hint + 1;
+	b->data = xmalloc(b->size);
+	b->data[0] = '\0';
+	b->len = 0;
+}
+
+/* Make room for at least more bytes, doubling so appending stays linear */
+void
+buf_reserve(struct buf *b, size_t more)
+{
+	size_t size = b->size;
+
+	if (more > SIZE_MAX - b->len - 1) {
+		fprintf(stderr, "buf_reserve: size will overflow\n");
+		exit(1);
+	}
+	if (b->len + more + 1 <= size) return;
+
+	if (size < 256) {
+		size = 256;
+	}
+	while (size < b->len + more + 1) {
+		size = size > SIZE_MAX / 2 ? SIZE_MAX : size * 2;
+	}
+	b->data = xrealloc(b->data, size);
+	b->size = size;
+}
+
+void
+buf_append(struct buf *b, const void *data, size_t len)
+{
+	buf_reserve(b, len);
+	memcpy(b->data + b->len, data, len);
+	b->len += len;
+	b->data[b->len] = '\0';
+}
+
+void
+buf_appends(struct buf *b, const char *str)
+{
+	buf_append(b, str, strlen(str));
+}
+
+void
+buf_appendf(struct buf *b, const char *fmt, ...)
+{
+	va_list ap;
+	int ret;
+
+	va_start(ap, fmt);
+	ret = vsnprintf(b->data + b->len, b->size - b->len, fmt, ap);
+	va_end(ap);
+	if (ret < 0) {
+		perror("vsnprintf");
+		exit(1);
+	}
+
+	/* it didn't fit, so make room and do it again */
+	if ((size_t)ret >= b->size - b->len) {
+		buf_reserve(b, (size_t)ret);
+		va_start(ap, fmt);
+		ret = vsnprintf(b->data + b->len, b->size - b->len, fmt, ap);
+		va_end(ap);
+		if (ret < 0) {
+			perror("vsnprintf");
+			exit(1);
+		}
+	}
+	b->len += (size_t)ret;
+}
+
+/* Hand over the contents, leaving the buffer empty */
+char *
+buf_detach(struct buf *b, size_t *len)
+{
+	char *data = b->data;
+
+	if (len != NULL) {
+		*len = b->len;
+	}
+	b->data = NULL;
+	b->len = b->size = 0;
+	return data;
+}
+
+void
+buf_free(struct buf *b)
+{
+	free(b->data);
+	b->data = NULL;
+	b->len = b->size = 0;
+}
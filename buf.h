@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2015 Scarletts <scarlett@entering.space>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef BUF_H
+#define BUF_H
+#include <stddef.h>
+
+/* A growable string of bytes, always kept NUL-terminated */
+struct buf {
+	char *data;
+	size_t len;
+	size_t size;
+};
+
+void buf_init(struct buf *, size_t);
+
+void buf_reserve(struct buf *, size_t);
+
+void buf_append(struct buf *, const void *, size_t);
+
+void buf_appends(struct buf *, const char *);
+
+void buf_appendf(struct buf *, const char *, ...);
+
+char *buf_detach(struct buf *, size_t *);
+
+void buf_free(struct buf *);
+
+#endif
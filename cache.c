@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) 2015 Scarletts <scarlett@entering.space>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * A content-addressed store of parser output. Each entry is a file named
+ * after the hash of the source and the parser which produced it, so an
+ * entry never needs to be invalidated, only evicted. Entries are touched
+ * when used, and the least recently used go first once the store grows
+ * past its limit.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+
+#include "xalloc.h"
+#include "util.h"
+#include "cache.h"
+
+int
+cache_open(const char *dir)
+{
+	if (mkdir(dir, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) == -1 &&
+	    errno != EEXIST) {
+		perror(dir);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Look up an entry, which is mapped rather than read when possible; see
+ * fdmap_file() for how to give it back.
+ */
+char *
+cache_get(const char *dir, uint64_t key, size_t *out_len, size_t *map_len)
+{
+	int fd;
+	char *path = NULL;
+	char *data;
+
+	*map_len = 0;
+	xasprintf(&path, "%s/%016" PRIx64, dir, key);
+	fd = open(path, O_RDONLY);
+	free(path);
+	if (fd == -1) {
+		return NULL;
+	}
+
+	if ((data = fdmap_file(fd, out_len, map_len)) != NULL) {
+		futimens(fd, NULL);
+	}
+	close(fd);
+	return data;
+}
+
+int
+cache_put(const char *dir, uint64_t key, const char *data, size_t len)
+{
+	int fd;
+	int ret = 0;
+	char *tmp = NULL;
+	char *path = NULL;
+
+	xasprintf(&tmp, "%s/.tmp.XXXXXX", dir);
+	xasprintf(&path, "%s/%016" PRIx64, dir, key);
+
+	if ((fd = make_temp(tmp)) == -1) {
+		perror(tmp);
+		ret = -1;
+		goto end;
+	}
+	fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (write_fully(fd, data, len) == -1) {
+		ret = -1;
+	}
+	if (close(fd) == -1) {
+		perror("close");
+		ret = -1;
+	}
+	if (ret == 0 && rename(tmp, path) == -1) {
+		perror("rename");
+		ret = -1;
+	}
+	if (ret == -1) {
+		unlink(tmp);
+	}
+end:
+	free(tmp);
+	free(path);
+	return ret;
+}
+
+struct cache_file {
+	char *name;
+	off_t size;
+	time_t mtime;
+};
+
+static int
+compare_age(const void *v1, const void *v2)
+{
+	const struct cache_file *f1 = v1;
+	const struct cache_file *f2 = v2;
+
+	if (f1->mtime < f2->mtime) return -1;
+	if (f1->mtime > f2->mtime) return 1;
+	return 0;
+}
+
+/* Evict the least recently used entries until the store fits in max bytes */
+int
+cache_trim(const char *dir, unsigned long long max)
+{
+	DIR *d;
+	struct dirent *de;
+	struct cache_file *files = NULL;
+	size_t count = 0;
+	size_t bufsize = 0;
+	unsigned long long total = 0;
+	char *path = NULL;
+
+	if ((d = opendir(dir)) == NULL) {
+		perror(dir);
+		return -1;
+	}
+	while ((de = readdir(d)) != NULL) {
+		struct stat st;
+
+		if (de->d_name[0] == '.') continue;
+
+		xasprintf(&path, "%s/%s", dir, de->d_name);
+		if (stat(path, &st) == 0) {
+			if (count >= bufsize) {
+				bufsize = bufsize == 0 ? 64 : bufsize * 2;
+				files = xreallocarray(files, bufsize,
+				    sizeof(struct cache_file));
+			}
+			files[count].name = xstrdup(de->d_name);
+			files[count].size = st.st_size;
+			files[count].mtime = st.st_mtim.tv_sec;
+			total += (unsigned long long)st.st_size;
+			++count;
+		}
+		free(path);
+	}
+	closedir(d);
+
+	qsort(files, count, sizeof(struct cache_file), compare_age);
+
+	for (size_t i = 0; i < count; ++i) {
+		if (total > max) {
+			xasprintf(&path, "%s/%s", dir, files[i].name);
+			if (unlink(path) == 0) {
+				total -= (unsigned long long)files[i].size;
+			}
+			free(path);
+		}
+		free(files[i].name);
+	}
+	free(files);
+	return 0;
+}
@@ -0,0 +1,293 @@
+/*
+ * Copyright (c) 2015 Scarletts <scarlett@entering.space>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+
+#include "xalloc.h"
+#include "buf.h"
+#include "util.h"
+#include "spawn.h"
+#include "coproc.h"
+
+int
+frame_write(int fd, const char *data, size_t len)
+{
+	char head[32];
+	int n;
+
+	n = snprintf(head, sizeof(head), "%zu\n", len);
+	if (write_fully(fd, head, (size_t)n) == -1 ||
+	    write_fully(fd, data, len) == -1) {
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Read one frame. On a clean end of file before the length, NULL is
+ * returned with *eof set, so that callers can tell it from an error.
+ */
+char *
+frame_read(int fd, size_t *out_len, int *eof)
+{
+	size_t len = 0;
+	size_t digits = 0;
+	char *buf;
+	char c;
+	ssize_t ret;
+
+	if (eof != NULL) {
+		*eof = 0;
+	}
+
+	for (;;) {
+		if ((ret = read(fd, &c, 1)) == -1) {
+			if (errno == EINTR) continue;
+			perror("read");
+			return NULL;
+		}
+		if (ret == 0) {
+			if (digits == 0 && eof != NULL) {
+				*eof = 1;
+				return NULL;
+			}
+			fprintf(stderr, "frame_read: unexpected end of file\n");
+			return NULL;
+		}
+		if (c == '\n' && digits > 0) break;
+		if (c < '0' || c > '9' || len > (SIZE_MAX - 9) / 10) {
+			fprintf(stderr, "frame_read: bad frame length\n");
+			return NULL;
+		}
+		len = len * 10 + (size_t)(c - '0');
+		++digits;
+	}
+
+	buf = xmalloc(len + 1);
+	if (read_fully(fd, buf, len) == -1) {
+		free(buf);
+		return NULL;
+	}
+	buf[len] = '\0';
+
+	if (out_len != NULL) {
+		*out_len = len;
+	}
+	return buf;
+}
+
+int
+coproc_start(struct coproc *cp, const char *cmd)
+{
+	int to_child[2];
+	int from_child[2];
+	char *args[4];
+
+	if (pipe(to_child) == -1) {
+		perror("pipe");
+		return -1;
+	}
+	if (pipe(from_child) == -1) {
+		perror("pipe");
+		close(to_child[0]);
+		close(to_child[1]);
+		return -1;
+	}
+
+	/* the child only keeps the ends it is given as stdin and stdout */
+	fcntl(to_child[0], F_SETFD, FD_CLOEXEC);
+	fcntl(to_child[1], F_SETFD, FD_CLOEXEC);
+	fcntl(from_child[0], F_SETFD, FD_CLOEXEC);
+	fcntl(from_child[1], F_SETFD, FD_CLOEXEC);
+
+	args[0] = "/bin/sh";
+	args[1] = "-c";
+	args[2] = (char *)cmd;
+	args[3] = NULL;
+	cp->pid = spawn_process(args, to_child[0], from_child[1]);
+
+	close(to_child[0]);
+	close(from_child[1]);
+	if (cp->pid == -1) {
+		close(to_child[1]);
+		close(from_child[0]);
+		return -1;
+	}
+	cp->in = to_child[1];
+	cp->out = from_child[0];
+
+	/* see coproc_render() */
+	if (fcntl(cp->in, F_SETFL, fcntl(cp->in, F_GETFL) | O_NONBLOCK) ==
+	    -1) {
+		perror("fcntl");
+		coproc_stop(cp);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Once the whole reply has arrived, return where its body starts, or 0
+ * while more is needed. Anything after the body is an error, as the
+ * parser can't answer a page it hasn't been sent.
+ */
+static int
+reply_done(const struct buf *b, size_t *start, size_t *len)
+{
+	size_t n = 0;
+	size_t i;
+
+	for (i = 0; i < b->len && b->data[i] != '\n'; ++i) {
+		if (b->data[i] < '0' || b->data[i] > '9' ||
+		    n > (SIZE_MAX - 9) / 10) {
+			fprintf(stderr, "coproc_render: bad frame length\n");
+			return -1;
+		}
+		n = n * 10 + (size_t)(b->data[i] - '0');
+	}
+	if (i == b->len) return 0;
+	if (i == 0 || n > SIZE_MAX - i - 1) {
+		fprintf(stderr, "coproc_render: bad frame length\n");
+		return -1;
+	}
+	if (b->len < i + 1 + n) return 0;
+	if (b->len > i + 1 + n) {
+		fprintf(stderr, "coproc_render: parser replied too much\n");
+		return -1;
+	}
+	*start = i + 1;
+	*len = n;
+	return 1;
+}
+
+/*
+ * Send a page and read the reply at once, rather than one after the
+ * other: a parser may start answering before it has read the whole page,
+ * and would otherwise fill its stdout while we were still stuck writing
+ * to its stdin.
+ */
+char *
+coproc_render(struct coproc *cp, const char *src, size_t len,
+    size_t *out_len)
+{
+	char head[32];
+	size_t head_len;
+	size_t sent = 0;
+	struct buf reply = {0};
+	struct pollfd pfd[2];
+	size_t start = 0;
+	size_t body_len = 0;
+	ssize_t ret;
+	int done = 0;
+
+	head_len = (size_t)snprintf(head, sizeof(head), "%zu\n", len);
+
+	while (done == 0) {
+		nfds_t n = 0;
+
+		if (sent < head_len + len) {
+			pfd[n].fd = cp->in;
+			pfd[n++].events = POLLOUT;
+		}
+		pfd[n].fd = cp->out;
+		pfd[n++].events = POLLIN;
+		if (poll(pfd, n, -1) == -1) {
+			if (errno == EINTR) continue;
+			perror("poll");
+			goto error;
+		}
+
+		if (n == 2 && pfd[0].revents != 0) {
+			if (sent < head_len) {
+				ret = write(cp->in, head + sent,
+				    head_len - sent);
+			} else {
+				ret = write(cp->in, src + sent - head_len,
+				    len - (sent - head_len));
+			}
+			if (ret == -1 && errno != EAGAIN && errno != EINTR) {
+				perror("write");
+				goto error;
+			}
+			if (ret > 0) sent += (size_t)ret;
+		}
+
+		if (pfd[n - 1].revents == 0) continue;
+		buf_reserve(&reply, 65536);
+		ret = read(cp->out, reply.data + reply.len,
+		    reply.size - reply.len - 1);
+		if (ret == -1) {
+			if (errno == EAGAIN || errno == EINTR) continue;
+			perror("read");
+			goto error;
+		}
+		if (ret == 0) {
+			fprintf(stderr,
+			    "coproc_render: parser stopped responding\n");
+			goto error;
+		}
+		reply.len += (size_t)ret;
+		if ((done = reply_done(&reply, &start, &body_len)) == -1) {
+			goto error;
+		}
+	}
+
+	if (sent < head_len + len) {
+		fprintf(stderr,
+		    "coproc_render: parser replied before reading the page\n");
+		goto error;
+	}
+	memmove(reply.data, reply.data + start, body_len);
+	reply.data[body_len] = '\0';
+	if (out_len != NULL) {
+		*out_len = body_len;
+	}
+	return reply.data;
+error:
+	buf_free(&reply);
+	return NULL;
+}
+
+int
+coproc_stop(struct coproc *cp)
+{
+	int status;
+
+	if (cp->pid <= 0) return 0;
+
+	close(cp->in);
+	close(cp->out);
+	if (waitpid(cp->pid, &status, 0) == -1) {
+		perror("wait");
+		return -1;
+	}
+	cp->pid = 0;
+	if (status != 0) {
+		fprintf(stderr,
+		    "coproc_stop: parser terminated unsuccessfully\n");
+		return -1;
+	}
+	return 0;
+}
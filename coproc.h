@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2015 Scarletts <scarlett@entering.space>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef COPROC_H
+#define COPROC_H
+#include <sys/types.h>
+#include <stddef.h>
+
+/*
+ * A long-lived parser, fed pages over its stdin and answering on its
+ * stdout. Each message in either direction is framed as the length in
+ * decimal, a newline, and then exactly that many bytes.
+ */
+struct coproc {
+	pid_t pid;
+	int in;
+	int out;
+};
+
+int coproc_start(struct coproc *, const char *);
+
+char *coproc_render(struct coproc *, const char *, size_t, size_t *);
+
+int coproc_stop(struct coproc *);
+
+int frame_write(int, const char *, size_t);
+
+char *frame_read(int, size_t *, int *);
+
+#endif
@@ -0,0 +1,274 @@
+/*
+ * Copyright (c) 2015 Scarletts <scarlett@entering.space>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * The date index is a text file with one line per page, sorted by path:
+ *
+ *	path<TAB>created
+ *
+ * where created is in seconds since the epoch. It's mapped and indexed
+ * once, looked up with a binary search, and rewritten only when pages
+ * have been added.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+
+#include "xalloc.h"
+#include "dates.h"
+
+static int
+compare_paths(const char *p1, size_t len1, const char *p2, size_t len2)
+{
+	int cmp = memcmp(p1, p2, len1 < len2 ? len1 : len2);
+
+	if (cmp != 0) return cmp;
+	if (len1 < len2) return -1;
+	if (len1 > len2) return 1;
+	return 0;
+}
+
+static int
+compare_entries(const void *v1, const void *v2)
+{
+	const struct date_entry *e1 = v1;
+	const struct date_entry *e2 = v2;
+
+	return compare_paths(e1->path, e1->path_len, e2->path, e2->path_len);
+}
+
+int
+dates_load(struct dates *d, const char *path)
+{
+	int fd;
+	struct stat st;
+	const char *p, *end;
+	size_t bufsize = 0;
+
+	memset(d, 0, sizeof(struct dates));
+
+	if ((fd = open(path, O_RDONLY)) == -1) {
+		if (errno == ENOENT) return 0;
+		perror(path);
+		return -1;
+	}
+	if (fstat(fd, &st) == -1) {
+		perror("fstat");
+		close(fd);
+		return -1;
+	}
+	if (st.st_size == 0) {
+		close(fd);
+		return 0;
+	}
+
+	d->map_len = (size_t)st.st_size;
+	d->map = mmap(NULL, d->map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (d->map == MAP_FAILED) {
+		perror("mmap");
+		d->map = NULL;
+		return -1;
+	}
+
+	end = d->map + d->map_len;
+	for (p = d->map; p < end;) {
+		const char *tab = NULL;
+		const char *nl;
+		struct date_entry *e;
+
+		for (nl = p; nl < end && *nl != '\n'; ++nl) {
+			if (*nl == '\t') tab = nl;
+		}
+		if (tab == NULL || tab == p) {
+			fprintf(stderr, "%s: ignoring malformed line\n", path);
+			p = nl + 1;
+			continue;
+		}
+
+		if (d->count >= bufsize) {
+			bufsize = bufsize == 0 ? 64 : bufsize * 2;
+			d->entries = xreallocarray(d->entries, bufsize,
+			    sizeof(struct date_entry));
+		}
+		e = &d->entries[d->count++];
+		e->path = p;
+		e->path_len = (size_t)(tab - p);
+		e->created = 0;
+		for (p = tab + 1; p < nl && *p >= '0' && *p <= '9'; ++p) {
+			e->created = e->created * 10 + (*p - '0');
+		}
+		p = nl + 1;
+	}
+
+	/* it should already be sorted, unless someone edited it by hand */
+	for (size_t i = 1; i < d->count; ++i) {
+		if (compare_entries(&d->entries[i - 1], &d->entries[i]) > 0) {
+			qsort(d->entries, d->count, sizeof(struct date_entry),
+			    compare_entries);
+			break;
+		}
+	}
+	return 0;
+}
+
+bool
+dates_lookup(const struct dates *d, const char *path, time_t *created)
+{
+	size_t len = strlen(path);
+	size_t lo = 0;
+	size_t hi = d->count;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		const struct date_entry *e = &d->entries[mid];
+		int cmp = compare_paths(path, len, e->path, e->path_len);
+
+		if (cmp == 0) {
+			*created = e->created;
+			return true;
+		}
+		if (cmp < 0) {
+			hi = mid;
+		} else {
+			lo = mid + 1;
+		}
+	}
+	return false;
+}
+
+void
+dates_add(struct dates *d, const char *path, time_t created)
+{
+	struct date_entry *e;
+
+	/* these can't be stored, so such pages always look new */
+	if (strpbrk(path, "\t\n") != NULL) return;
+
+	if (d->string_count >= d->string_bufsize) {
+		d->string_bufsize = d->string_bufsize == 0 ?
+		    16 : d->string_bufsize * 2;
+		d->strings = xreallocarray(d->strings, d->string_bufsize,
+		    sizeof(char *));
+	}
+	d->strings[d->string_count++] = xstrdup(path);
+
+	if (d->added_count >= d->added_bufsize) {
+		d->added_bufsize = d->added_bufsize == 0 ?
+		    16 : d->added_bufsize * 2;
+		d->added = xreallocarray(d->added, d->added_bufsize,
+		    sizeof(struct date_entry));
+	}
+	e = &d->added[d->added_count++];
+	e->path = d->strings[d->string_count - 1];
+	e->path_len = strlen(path);
+	e->created = created;
+}
+
+static int
+write_entry(FILE *fp, const struct date_entry *e)
+{
+	if (fwrite(e->path, 1, e->path_len, fp) < e->path_len ||
+	    fprintf(fp, "\t%lld\n", (long long)e->created) < 0) {
+		perror("fwrite");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Merge the added dates into the index, replacing it atomically so that
+ * creation dates are never lost to an interrupted build. Afterwards the
+ * added dates can be looked up like the rest.
+ */
+int
+dates_save(struct dates *d, const char *path)
+{
+	int ret = 0;
+	FILE *fp;
+	char *tmp = NULL;
+	struct date_entry *merged;
+	size_t count = 0;
+	size_t i = 0;
+	size_t j = 0;
+
+	if (d->added_count == 0) return 0;
+
+	qsort(d->added, d->added_count, sizeof(struct date_entry),
+	    compare_entries);
+
+	xasprintf(&tmp, "%s.tmp", path);
+	if ((fp = fopen(tmp, "w")) == NULL) {
+		perror(tmp);
+		free(tmp);
+		return -1;
+	}
+
+	merged = xreallocarray(NULL, d->count + d->added_count,
+	    sizeof(struct date_entry));
+	while (i < d->count || j < d->added_count) {
+		if (j == d->added_count || (i < d->count &&
+		    compare_entries(&d->entries[i], &d->added[j]) < 0)) {
+			merged[count] = d->entries[i++];
+		} else {
+			merged[count] = d->added[j++];
+		}
+		if (ret == 0) {
+			ret = write_entry(fp, &merged[count]);
+		}
+		++count;
+	}
+	free(d->entries);
+	d->entries = merged;
+	d->count = count;
+	d->added_count = 0;
+
+	if (fclose(fp) != 0) {
+		perror("fclose");
+		ret = -1;
+	}
+	if (ret == 0 && rename(tmp, path) == -1) {
+		perror("rename");
+		ret = -1;
+	}
+	if (ret == -1) {
+		unlink(tmp);
+	}
+	free(tmp);
+	return ret;
+}
+
+void
+dates_free(struct dates *d)
+{
+	if (d->map != NULL) {
+		munmap(d->map, d->map_len);
+	}
+	for (size_t i = 0; i < d->string_count; ++i) {
+		free(d->strings[i]);
+	}
+	free(d->strings);
+	free(d->entries);
+	free(d->added);
+	memset(d, 0, sizeof(struct dates));
+}
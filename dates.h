@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2015 Scarletts <scarlett@entering.space>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef DATES_H
+#define DATES_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+struct date_entry {
+	const char *path;
+	size_t path_len;
+	time_t created;
+};
+
+/* Creation dates of pages, by their path under src */
+struct dates {
+	char *map;
+	size_t map_len;
+	struct date_entry *entries;
+	size_t count;
+	struct date_entry *added;
+	size_t added_count;
+	size_t added_bufsize;
+	char **strings;
+	size_t string_count;
+	size_t string_bufsize;
+};
+
+int dates_load(struct dates *, const char *);
+
+bool dates_lookup(const struct dates *, const char *, time_t *);
+
+void dates_add(struct dates *, const char *, time_t);
+
+int dates_save(struct dates *, const char *);
+
+void dates_free(struct dates *);
+
+#endif
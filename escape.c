@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2015 Scarletts <scarlett@entering.space>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Escaping of text put into HTML or XML, in elements or attributes. Most
+ * text has nothing to escape, so the work is in finding the next
+ * character which needs it as quickly as possible: 32 or 16 bytes at a
+ * time where the compiler targets AVX2 or SSE2, a byte at a time
+ * otherwise. Everything in between is copied in one go.
+ */
+
+#if defined(__GNUC__) && (defined(__AVX2__) || defined(__SSE2__))
+#include <immintrin.h>
+#define ESCAPE_SIMD
+#endif
+#include <string.h>
+
+#include "buf.h"
+#include "escape.h"
+
+static const char *const entities[256] = {
+	['"'] = "&quot;",
+	['&'] = "&amp;",
+	['\''] = "&#39;",
+	['<'] = "&lt;",
+	['>'] = "&gt;",
+};
+
+/* Returns how many bytes from the start of s need no escaping */
+static size_t
+clean_run(const char *s, size_t len)
+{
+	size_t i = 0;
+
+#ifdef __AVX2__
+	{
+		const __m256i quot = _mm256_set1_epi8('"');
+		const __m256i amp = _mm256_set1_epi8('&');
+		const __m256i apos = _mm256_set1_epi8('\'');
+		const __m256i lt = _mm256_set1_epi8('<');
+		const __m256i gt = _mm256_set1_epi8('>');
+
+		for (; i + 32 <= len; i += 32) {
+			__m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+			__m256i m = _mm256_or_si256(
+			    _mm256_or_si256(_mm256_cmpeq_epi8(v, quot),
+			    _mm256_cmpeq_epi8(v, amp)),
+			    _mm256_or_si256(_mm256_cmpeq_epi8(v, apos),
+			    _mm256_or_si256(_mm256_cmpeq_epi8(v, lt),
+			    _mm256_cmpeq_epi8(v, gt))));
+			unsigned int mask = (unsigned int)_mm256_movemask_epi8(m);
+
+			if (mask != 0) {
+				return i + (size_t)__builtin_ctz(mask);
+			}
+		}
+	}
+#endif
+#ifdef ESCAPE_SIMD
+	{
+		const __m128i quot = _mm_set1_epi8('"');
+		const __m128i amp = _mm_set1_epi8('&');
+		const __m128i apos = _mm_set1_epi8('\'');
+		const __m128i lt = _mm_set1_epi8('<');
+		const __m128i gt = _mm_set1_epi8('>');
+
+		for (; i + 16 <= len; i += 16) {
+			__m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+			__m128i m = _mm_or_si128(
+			    _mm_or_si128(_mm_cmpeq_epi8(v, quot),
+			    _mm_cmpeq_epi8(v, amp)),
+			    _mm_or_si128(_mm_cmpeq_epi8(v, apos),
+			    _mm_or_si128(_mm_cmpeq_epi8(v, lt),
+			    _mm_cmpeq_epi8(v, gt))));
+			unsigned int mask = (unsigned int)_mm_movemask_epi8(m);
+
+			if (mask != 0) {
+				return i + (size_t)__builtin_ctz(mask);
+			}
+		}
+	}
+#endif
+	for (; i < len; ++i) {
+		if (entities[(unsigned char)s[i]] != NULL) break;
+	}
+	return i;
+}
+
+void
+escape_append(struct buf *b, const char *s, size_t len)
+{
+	size_t n;
+
+	buf_reserve(b, len);
+	for (;;) {
+		n = clean_run(s, len);
+		buf_append(b, s, n);
+		if (n == len) break;
+
+		buf_appends(b, entities[(unsigned char)s[n]]);
+		s += n + 1;
+		len -= n + 1;
+	}
+}
+
+void
+escape_appends(struct buf *b, const char *s)
+{
+	if (s == NULL) {
+		buf_reserve(b, 0);
+		return;
+	}
+	escape_append(b, s, strlen(s));
+}
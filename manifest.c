@@ -0,0 +1,232 @@
+/*
+ * Copyright (c) 2015 Scarletts <scarlett@entering.space>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * The manifest is a text file, starting with a line holding its version
+ * and a hash of everything which affects every page (templates, options).
+ * Each following line describes one page, tab separated:
+ *
+ *	mtime mtime_nsec size uid created hash out_size body_off body_len path
+ */
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+
+#include "xalloc.h"
+#include "util.h"
+#include "hash.h"
+#include "manifest.h"
+
+#define MANIFEST_VERSION "pswg-manifest 1"
+
+static int
+parse_entry(char *line, struct manifest_entry *e)
+{
+	long long v[9];
+	char *p = line;
+	char *end;
+
+	for (size_t i = 0; i < 9; ++i) {
+		errno = 0;
+		if (i == 5) {
+			e->hash = strtoull(p, &end, 16);
+			v[i] = 0;
+		} else {
+			v[i] = strtoll(p, &end, 10);
+		}
+		if (errno != 0 || end == p || *end != '\t') return -1;
+		p = end + 1;
+	}
+	if (*p == '\0') return -1;
+
+	e->mtime = (time_t)v[0];
+	e->mtime_nsec = (long)v[1];
+	e->size = (off_t)v[2];
+	e->uid = (uid_t)v[3];
+	e->created = (time_t)v[4];
+	e->out_size = (off_t)v[6];
+	e->body_off = (size_t)v[7];
+	e->body_len = (size_t)v[8];
+	e->path = xstrdup(p);
+	return 0;
+}
+
+static void
+index_entries(struct manifest *m)
+{
+	m->table_size = 16;
+	while (m->table_size < m->count * 2) {
+		m->table_size *= 2;
+	}
+	m->table = xreallocarray(NULL, m->table_size, sizeof(size_t));
+	for (size_t i = 0; i < m->table_size; ++i) {
+		m->table[i] = SIZE_MAX;
+	}
+	for (size_t i = 0; i < m->count; ++i) {
+		size_t slot = hash_str(m->entries[i].path, 0) &
+		    (m->table_size - 1);
+
+		while (m->table[slot] != SIZE_MAX) {
+			slot = (slot + 1) & (m->table_size - 1);
+		}
+		m->table[slot] = i;
+	}
+}
+
+/*
+ * Load the manifest from the last build. A missing or unreadable manifest
+ * is not an error, it just means everything gets built.
+ */
+int
+manifest_load(struct manifest *m, const char *path)
+{
+	char *text, *line, *next;
+	size_t bufsize = 0;
+
+	memset(m, 0, sizeof(struct manifest));
+
+	if (access(path, F_OK) == -1 ||
+	    (text = read_file(path, NULL)) == NULL) {
+		index_entries(m);
+		return 0;
+	}
+
+	line = text;
+	if ((next = strchr(line, '\n')) == NULL ||
+	    strncmp(line, MANIFEST_VERSION " ",
+	    sizeof(MANIFEST_VERSION)) != 0) {
+		fprintf(stderr, "%s: unknown format, ignoring it\n", path);
+		free(text);
+		index_entries(m);
+		return 0;
+	}
+	*next = '\0';
+	m->inputs = strtoull(line + sizeof(MANIFEST_VERSION), NULL, 16);
+
+	for (line = next + 1; *line != '\0'; line = next + 1) {
+		if ((next = strchr(line, '\n')) == NULL) break;
+		*next = '\0';
+
+		if (m->count >= bufsize) {
+			bufsize = bufsize == 0 ? 64 : bufsize * 2;
+			m->entries = xreallocarray(m->entries, bufsize,
+			    sizeof(struct manifest_entry));
+		}
+		if (parse_entry(line, &m->entries[m->count]) == 0) {
+			++m->count;
+		}
+	}
+
+	free(text);
+	index_entries(m);
+	return 0;
+}
+
+struct manifest_entry *
+manifest_find(const struct manifest *m, const char *path)
+{
+	size_t slot = hash_str(path, 0) & (m->table_size - 1);
+
+	for (; m->table[slot] != SIZE_MAX;
+	    slot = (slot + 1) & (m->table_size - 1)) {
+		struct manifest_entry *e = &m->entries[m->table[slot]];
+
+		if (strcmp(e->path, path) == 0) {
+			return e;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * The new manifest is written next to the old one, and only replaces it
+ * in manifest_commit(), so that an interrupted build can't leave behind a
+ * manifest describing pages which were never written.
+ */
+FILE *
+manifest_create(const char *path, uint64_t inputs)
+{
+	char *tmp = NULL;
+	FILE *fp;
+
+	xasprintf(&tmp, "%s.tmp", path);
+	if ((fp = fopen(tmp, "w")) == NULL) {
+		perror(tmp);
+		free(tmp);
+		return NULL;
+	}
+	free(tmp);
+
+	if (fprintf(fp, MANIFEST_VERSION " %016" PRIx64 "\n", inputs) < 0) {
+		perror("fprintf");
+		fclose(fp);
+		return NULL;
+	}
+	return fp;
+}
+
+int
+manifest_add(FILE *fp, const struct manifest_entry *e)
+{
+	/* these would break the format, such pages are just always built */
+	if (strchr(e->path, '\n') != NULL) return 0;
+
+	if (fprintf(fp, "%lld\t%ld\t%lld\t%lu\t%lld\t%016" PRIx64
+	    "\t%lld\t%zu\t%zu\t%s\n",
+	    (long long)e->mtime, e->mtime_nsec, (long long)e->size,
+	    (unsigned long)e->uid, (long long)e->created, e->hash,
+	    (long long)e->out_size, e->body_off, e->body_len,
+	    e->path) < 0) {
+		perror("fprintf");
+		return -1;
+	}
+	return 0;
+}
+
+int
+manifest_commit(FILE *fp, const char *path)
+{
+	int ret = 0;
+	char *tmp = NULL;
+
+	xasprintf(&tmp, "%s.tmp", path);
+	if (fclose(fp) != 0) {
+		perror("fclose");
+		unlink(tmp);
+		ret = -1;
+	} else if (rename(tmp, path) == -1) {
+		perror("rename");
+		ret = -1;
+	}
+	free(tmp);
+	return ret;
+}
+
+void
+manifest_free(struct manifest *m)
+{
+	for (size_t i = 0; i < m->count; ++i) {
+		free(m->entries[i].path);
+	}
+	free(m->entries);
+	free(m->table);
+	memset(m, 0, sizeof(struct manifest));
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2015 Scarletts <scarlett@entering.space>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef MANIFEST_H
+#define MANIFEST_H
+#include <sys/types.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+/* What a page was last built from, and where its body is in the output */
+struct manifest_entry {
+	char *path;
+	time_t mtime;
+	long mtime_nsec;
+	off_t size;
+	uid_t uid;
+	time_t created;
+	uint64_t hash;
+	off_t out_size;
+	size_t body_off;
+	size_t body_len;
+};
+
+struct manifest {
+	uint64_t inputs;
+	struct manifest_entry *entries;
+	size_t count;
+	size_t *table;
+	size_t table_size;
+};
+
+int manifest_load(struct manifest *, const char *);
+
+struct manifest_entry *manifest_find(const struct manifest *, const char *);
+
+FILE *manifest_create(const char *, uint64_t);
+
+int manifest_add(FILE *, const struct manifest_entry *);
+
+int manifest_commit(FILE *, const char *);
+
+void manifest_free(struct manifest *);
+
+#endif
@@ -0,0 +1,1457 @@
+/*
+ * Copyright (c) 2015 Scarletts <scarlett@entering.space>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * A renderer for the commonly used part of CommonMark, so that markdown
+ * pages need no parser process at all.
+ *
+ * Blocks are found a line at a time, like CommonMark does: each line first
+ * continues the open block quotes and list items, then may start new ones,
+ * and what is left is a paragraph, heading, code block, rule or HTML.
+ * Only paragraphs are held back, to be rendered inline once they end;
+ * everything else is written out as soon as it is seen. A list is loose
+ * (its paragraphs get <p>) once a blank line is found between its parts,
+ * which can't change how the paragraphs before it were written.
+ *
+ * Inline, there are code spans, emphasis, links and images with their
+ * destination given inline (not by reference), autolinks, backslash
+ * escapes, entities, hard breaks and raw HTML. Emphasis, links and the
+ * brackets and parentheses inside them nest INLINE_DEPTH deep at most,
+ * deeper being left as text, so that rendering stays linear in the text.
+ */
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "buf.h"
+#include "entities.h"
+#include "escape.h"
+#include "markdown.h"
+
+#define INLINE_DEPTH	32	/* nested emphasis and links, deeper is text */
+#define INLINE_TICKS	16	/* code spans remembered as missing */
+
+struct line {
+	const char *p;
+	const char *end;
+	size_t col;	/* of p, tabs going to the next multiple of 4 */
+};
+
+struct link {
+	const char *text;
+	const char *text_end;
+	const char *dest;
+	const char *dest_end;
+	const char *title;	/* NULL if there isn't one */
+	const char *title_end;
+	const char *next;
+};
+
+static const bool inline_special[256] = {
+	['\n'] = true,
+	['\\'] = true,
+	['`'] = true,
+	['*'] = true,
+	['_'] = true,
+	['['] = true,
+	['!'] = true,
+	['<'] = true,
+	['&'] = true,
+};
+
+/*
+ * Looking for what would close an opener means going through the rest of
+ * the text when there isn't one, and doing that again for every opener
+ * of the same kind takes time quadratic in the text. So each which fails
+ * is remembered, and not looked for again further on, so long as the end
+ * it was looked for up to is no nearer.
+ */
+struct miss {
+	const char *from;	/* NULL if nothing has failed yet */
+	const char *to;
+};
+
+/* What goes along with rendering the inlines of one paragraph or heading */
+struct inline_state {
+	struct buf *out;
+	size_t depth;		/* of emphasis and links, INLINE_DEPTH at most */
+	bool plain;		/* only the text, for an image's alt */
+	struct miss emphasis[2][3];	/* for * and _, by the length */
+	struct miss ticks[INLINE_TICKS];	/* code spans, by the length */
+	struct miss tag_end;	/* the > of raw HTML */
+};
+
+static void render_inline(struct buf *, const char *, const char *);
+
+static void render_spans(struct inline_state *, const char *, const char *);
+
+static bool
+is_space(char c)
+{
+	return c == ' ' || c == '\t';
+}
+
+static bool
+is_blank(const struct line *l)
+{
+	for (const char *p = l->p; p < l->end; ++p) {
+		if (!is_space(*p)) return false;
+	}
+	return true;
+}
+
+static size_t
+next_col(size_t col, char c)
+{
+	return c == '\t' ? col + 4 - col % 4 : col + 1;
+}
+
+/* Columns of whitespace at the start of l */
+static size_t
+indent_of(const struct line *l)
+{
+	size_t col = l->col;
+
+	for (const char *p = l->p; p < l->end && is_space(*p); ++p) {
+		col = next_col(col, *p);
+	}
+	return col - l->col;
+}
+
+/* Skip whitespace up to n columns on; a tab may take it further */
+static void
+skip_indent(struct line *l, size_t n)
+{
+	size_t target = l->col + n;
+
+	while (l->p < l->end && l->col < target && is_space(*l->p)) {
+		l->col = next_col(l->col, *l->p);
+		++l->p;
+	}
+}
+
+static void
+skip_char(struct line *l)
+{
+	++l->p;
+	++l->col;
+}
+
+/* Returns the level of an ATX heading, or 0 */
+static int
+heading_level(const struct line *l)
+{
+	const char *p = l->p;
+	int level = 0;
+
+	while (p < l->end && *p == '#' && level <= 6) {
+		++p;
+		++level;
+	}
+	if (level > 6 || (p < l->end && !is_space(*p))) return 0;
+	return level;
+}
+
+/* Returns the level of the heading this underlines, or 0 */
+static int
+setext_level(const struct line *l)
+{
+	const char *p = l->p;
+	char c;
+
+	if (p >= l->end || (*p != '=' && *p != '-')) return 0;
+	for (c = *p; p < l->end && *p == c; ++p);
+	for (; p < l->end; ++p) {
+		if (!is_space(*p)) return 0;
+	}
+	return c == '=' ? 1 : 2;
+}
+
+static bool
+is_rule(const struct line *l)
+{
+	size_t n = 0;
+	char c;
+
+	if (l->p >= l->end) return false;
+	c = *l->p;
+	if (c != '-' && c != '*' && c != '_') return false;
+	for (const char *p = l->p; p < l->end; ++p) {
+		if (*p == c) {
+			++n;
+		} else if (!is_space(*p)) {
+			return false;
+		}
+	}
+	return n >= 3;
+}
+
+/* Returns the length of a code fence, setting c to its character, or 0 */
+static size_t
+fence_of(const struct line *l, char *c)
+{
+	const char *p = l->p;
+
+	if (p >= l->end || (*p != '`' && *p != '~')) return 0;
+	*c = *p;
+	while (p < l->end && *p == *c) ++p;
+	if (p - l->p < 3) return 0;
+
+	/* backticks can't be in the info string, or it'd be a code span */
+	if (*c == '`' && memchr(p, '`', (size_t)(l->end - p)) != NULL) {
+		return 0;
+	}
+	return (size_t)(p - l->p);
+}
+
+/*
+ * Returns the kind of list item l starts with: -, + or * for a bullet,
+ * or . or ) for a number, in which case start is set to it. width is
+ * set to the width of the marker.
+ */
+static char
+list_marker(const struct line *l, size_t *width, unsigned long *start)
+{
+	const char *p = l->p;
+	char kind;
+
+	if (p >= l->end) return 0;
+	if (*p == '-' || *p == '+' || *p == '*') {
+		kind = *p++;
+	} else {
+		*start = 0;
+		while (p < l->end && isdigit((unsigned char)*p) &&
+		    p - l->p < 9) {
+			*start = *start * 10 + (unsigned long)(*p++ - '0');
+		}
+		if (p == l->p || p >= l->end || (*p != '.' && *p != ')')) {
+			return 0;
+		}
+		kind = *p++;
+	}
+	if (p < l->end && !is_space(*p)) return 0;
+	*width = (size_t)(p - l->p);
+	return kind;
+}
+
+/* Elements whose contents may hold blank lines, ended by their closing tag */
+static const char *const html_raw[] = {
+	"pre", "script", "style", "textarea", NULL
+};
+
+static const char *const html_blocks[] = {
+	"address", "article", "aside", "base", "basefont", "blockquote",
+	"body", "caption", "center", "col", "colgroup", "dd", "details",
+	"dialog", "dir", "div", "dl", "dt", "fieldset", "figcaption",
+	"figure", "footer", "form", "frame", "frameset", "h1", "h2", "h3",
+	"h4", "h5", "h6", "head", "header", "hr", "html", "iframe",
+	"legend", "li", "link", "main", "menu", "menuitem", "nav",
+	"noframes", "ol", "optgroup", "option", "p", "param", "search",
+	"section", "summary", "table", "tbody", "td", "tfoot", "th",
+	"thead", "title", "tr", "track", "ul", NULL
+};
+
+static bool
+name_in(const char *s, size_t n, const char *const *names)
+{
+	for (; *names != NULL; ++names) {
+		if (strlen(*names) == n && strncasecmp(s, *names, n) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool
+attr_char(char c)
+{
+	return isalnum((unsigned char)c) || c == '_' || c == '.' ||
+	    c == ':' || c == '-';
+}
+
+/* Skip the open or closing tag at p, returning NULL if it isn't one */
+static const char *
+skip_tag(const char *p, const char *end)
+{
+	bool closing;
+	const char *q;
+
+	closing = ++p < end && *p == '/';
+	if (closing) ++p;
+	if (p >= end || !isalpha((unsigned char)*p)) return NULL;
+	while (p < end && (isalnum((unsigned char)*p) || *p == '-')) ++p;
+
+	if (closing) {
+		while (p < end && is_space(*p)) ++p;
+		return p < end && *p == '>' ? p + 1 : NULL;
+	}
+	for (;;) {
+		for (q = p; q < end && is_space(*q); ++q);
+		if (q < end && *q == '>') return q + 1;
+		if (end - q >= 2 && q[0] == '/' && q[1] == '>') return q + 2;
+
+		/* an attribute, after some space */
+		if (q == p || q >= end ||
+		    !(isalpha((unsigned char)*q) || *q == '_' || *q == ':')) {
+			return NULL;
+		}
+		while (q < end && attr_char(*q)) ++q;
+		p = q;
+
+		while (q < end && is_space(*q)) ++q;
+		if (q >= end || *q != '=') continue;
+		for (++q; q < end && is_space(*q); ++q);
+		if (q >= end) return NULL;
+		if (*q == '"' || *q == '\'') {
+			if ((p = memchr(q + 1, *q, (size_t)(end - q - 1))) ==
+			    NULL) {
+				return NULL;
+			}
+			++p;
+		} else {
+			for (p = q; p < end && !is_space(*p) &&
+			    strchr("\"'=<>`", *p) == NULL; ++p);
+			if (p == q) return NULL;
+		}
+	}
+}
+
+/*
+ * Returns the kind of HTML block l starts, numbered as in CommonMark, or
+ * 0. 1 to 5 go on until a line holding what ends them, see html_end(),
+ * and 6 and 7 until a blank line. 7, any other tag alone on its line,
+ * can't interrupt a paragraph.
+ */
+static int
+html_start(const struct line *l)
+{
+	const char *p = l->p;
+	const char *end = l->end;
+	const char *q;
+	const char *s;
+	size_t n;
+
+	if (end - p < 2 || *p != '<') return 0;
+	q = p + 1;
+	if (*q == '?') return 3;
+	if (*q == '!') {
+		if (end - q >= 3 && memcmp(q, "!--", 3) == 0) return 2;
+		if (end - q >= 8 && memcmp(q, "![CDATA[", 8) == 0) return 5;
+		return end - q >= 2 && isalpha((unsigned char)q[1]) ? 4 : 0;
+	}
+
+	if (*q == '/') ++q;
+	for (s = q; s < end && (isalnum((unsigned char)*s) || *s == '-');
+	    ++s);
+	n = (size_t)(s - q);
+	if (n == 0 || !isalpha((unsigned char)*q)) return 0;
+
+	if (q == p + 1 && name_in(q, n, html_raw) &&
+	    (s == end || is_space(*s) || *s == '>')) {
+		return 1;
+	}
+	if (name_in(q, n, html_blocks) &&
+	    (s == end || is_space(*s) || *s == '>' ||
+	    (end - s >= 2 && s[0] == '/' && s[1] == '>'))) {
+		return 6;
+	}
+	if (!name_in(q, n, html_raw) && (s = skip_tag(p, end)) != NULL) {
+		while (s < end && is_space(*s)) ++s;
+		if (s == end) return 7;
+	}
+	return 0;
+}
+
+static bool
+has(const char *p, const char *end, const char *s)
+{
+	size_t n = strlen(s);
+
+	for (; (size_t)(end - p) >= n; ++p) {
+		if (strncasecmp(p, s, n) == 0) return true;
+	}
+	return false;
+}
+
+/* Whether the line from p to end ends an HTML block of the given kind */
+static bool
+html_end(int kind, const char *p, const char *end)
+{
+	switch (kind) {
+		case 1:
+			return has(p, end, "</pre>") ||
+			    has(p, end, "</script>") ||
+			    has(p, end, "</style>") ||
+			    has(p, end, "</textarea>");
+		case 2:
+			return has(p, end, "-->");
+		case 3:
+			return has(p, end, "?>");
+		case 4:
+			return has(p, end, ">");
+		case 5:
+			return has(p, end, "]]>");
+		default:
+			return false;
+	}
+}
+
+/* Whether l, after the containers it continues, starts a new block */
+static bool
+starts_block(const struct line *l)
+{
+	struct line t = *l;
+	size_t width;
+	unsigned long start;
+	char c;
+	int html;
+
+	if (indent_of(&t) >= 4) return false;
+	skip_indent(&t, 3);
+	if (t.p >= t.end) return false;
+
+	html = html_start(&t);
+	return *t.p == '>' || heading_level(&t) != 0 ||
+	    fence_of(&t, &c) != 0 || is_rule(&t) || (html != 0 && html != 7) ||
+	    list_marker(&t, &width, &start) != 0;
+}
+
+/* Blocks start on a line of their own, even right after an item's <li> */
+static void
+begin_block(struct buf *out)
+{
+	if (out->len > 0 && out->data[out->len - 1] != '\n') {
+		buf_appends(out, "\n");
+	}
+}
+
+static struct md_block *
+innermost(struct markdown *md)
+{
+	return md->depth > 0 ? &md->stack[md->depth - 1] : NULL;
+}
+
+static void
+flush_para(struct markdown *md)
+{
+	struct buf *para = &md->para;
+	struct md_block *b = innermost(md);
+	bool tight;
+
+	while (para->len > 0 && (is_space(para->data[para->len - 1]) ||
+	    para->data[para->len - 1] == '\n')) {
+		--para->len;
+	}
+
+	tight = b != NULL && b->type == MD_ITEM && !md->stack[md->depth - 2].loose;
+	if (!tight) {
+		begin_block(md->out);
+		buf_appends(md->out, "<p>");
+	}
+	render_inline(md->out, para->data, para->data + para->len);
+	if (!tight) buf_appends(md->out, "</p>\n");
+}
+
+static void
+close_leaf(struct markdown *md)
+{
+	switch (md->leaf) {
+		case MD_PARA:
+			flush_para(md);
+			break;
+		case MD_FENCE:
+		case MD_CODE:
+			buf_appends(md->out, "</code></pre>\n");
+			break;
+		case MD_HTML:
+		case MD_NONE:
+			break;
+	}
+	md->leaf = MD_NONE;
+	md->para_done = false;
+	md->code_blanks = 0;
+}
+
+/* Close everything from the nth container in */
+static void
+close_containers(struct markdown *md, size_t n)
+{
+	if (md->depth > n) close_leaf(md);
+
+	while (md->depth > n) {
+		const struct md_block *b = &md->stack[--md->depth];
+
+		switch (b->type) {
+			case MD_QUOTE:
+				buf_appends(md->out, "</blockquote>\n");
+				break;
+			case MD_LIST:
+				buf_appends(md->out, b->marker == '.' ||
+				    b->marker == ')' ? "</ol>\n" : "</ul>\n");
+				break;
+			case MD_ITEM:
+				buf_appends(md->out, "</li>\n");
+				break;
+		}
+	}
+}
+
+/*
+ * Returns how many of the open containers l continues, skipping their
+ * markers and indentation. A list goes on as long as its items do, or
+ * with another item of the same kind.
+ */
+static size_t
+match_containers(struct markdown *md, struct line *l, bool blank)
+{
+	size_t i;
+	struct line t;
+	size_t width;
+	unsigned long start;
+
+	for (i = 0; i < md->depth; ++i) {
+		struct md_block *b = &md->stack[i];
+
+		if (b->type == MD_LIST) continue;
+
+		if (b->type == MD_QUOTE) {
+			if (indent_of(l) >= 4) break;
+			t = *l;
+			skip_indent(&t, 3);
+			if (t.p >= t.end || *t.p != '>') break;
+			skip_char(&t);
+			skip_indent(&t, 1);
+			*l = t;
+		} else if (!blank) {
+			if (l->col + indent_of(l) < b->indent) break;
+			skip_indent(l, b->indent - l->col);
+		}
+	}
+
+	if (i < md->depth && md->stack[i].type == MD_ITEM) {
+		t = *l;
+		if (blank || indent_of(&t) >= 4) return i - 1;
+		skip_indent(&t, 3);
+		if (is_rule(&t) ||
+		    list_marker(&t, &width, &start) != md->stack[i - 1].marker) {
+			return i - 1;
+		}
+	}
+	return i;
+}
+
+static void
+open_block(struct markdown *md, enum md_container type, char marker,
+    size_t indent)
+{
+	struct md_block *b = &md->stack[md->depth++];
+
+	if (type != MD_ITEM) begin_block(md->out);
+	b->type = type;
+	b->marker = marker;
+	b->loose = false;
+	b->indent = indent;
+}
+
+/* Start whatever block quotes and list items l starts with */
+static void
+open_containers(struct markdown *md, struct line *l)
+{
+	struct line t;
+	struct line c;
+	struct md_block *b;
+	size_t width;
+	size_t n;
+	unsigned long start;
+	char kind;
+	bool empty;
+	bool same_list;
+
+	for (;;) {
+		t = *l;
+		if (indent_of(&t) >= 4) break;
+		skip_indent(&t, 3);
+
+		if (t.p < t.end && *t.p == '>') {
+			if (md->depth == MARKDOWN_DEPTH) break;
+			close_leaf(md);
+			open_block(md, MD_QUOTE, 0, 0);
+			buf_appends(md->out, "<blockquote>\n");
+			skip_char(&t);
+			skip_indent(&t, 1);
+			*l = t;
+			continue;
+		}
+
+		if (is_rule(&t) ||
+		    (kind = list_marker(&t, &width, &start)) == 0) {
+			break;
+		}
+		c = t;
+		c.p += width;
+		c.col += width;
+		empty = is_blank(&c);
+
+		/* only some items can interrupt a paragraph */
+		if (md->leaf == MD_PARA && !md->para_done &&
+		    (empty || ((kind == '.' || kind == ')') && start != 1))) {
+			break;
+		}
+
+		b = innermost(md);
+		same_list = b != NULL && b->type == MD_LIST && b->marker == kind;
+		if (md->depth + (same_list ? 1 : 2) > MARKDOWN_DEPTH) break;
+		close_leaf(md);
+
+		if (!same_list) {
+			open_block(md, MD_LIST, kind, 0);
+			if (kind != '.' && kind != ')') {
+				buf_appends(md->out, "<ul>\n");
+			} else if (start != 1) {
+				buf_appendf(md->out, "<ol start=\"%lu\">\n", start);
+			} else {
+				buf_appends(md->out, "<ol>\n");
+			}
+		}
+
+		/* more than four spaces in, the content is a code block */
+		n = empty ? 1 : indent_of(&c);
+		if (n > 4) n = 1;
+		skip_indent(&c, n);
+		if (empty) c.col = t.col + width + 1;
+		open_block(md, MD_ITEM, kind, c.col);
+		buf_appends(md->out, "<li>");
+		*l = c;
+	}
+
+	/* a list left without an item, if it got too deep */
+	b = innermost(md);
+	if (b != NULL && b->type == MD_LIST) {
+		close_containers(md, md->depth - 1);
+	}
+}
+
+static void
+fence_line(struct markdown *md, struct line *l)
+{
+	struct line t = *l;
+	size_t n;
+	char c;
+
+	if (indent_of(&t) < 4) {
+		skip_indent(&t, 3);
+		n = fence_of(&t, &c);
+		t.p += n;
+		if (n >= md->fence_len && c == md->fence && is_blank(&t)) {
+			close_leaf(md);
+			return;
+		}
+	}
+	skip_indent(l, md->fence_indent);
+	escape_append(md->out, l->p, (size_t)(l->end - l->p));
+	buf_appends(md->out, "\n");
+}
+
+static void
+open_fence(struct markdown *md, struct line *l, size_t indent, char c,
+    size_t n)
+{
+	const char *info;
+	const char *info_end;
+
+	md->leaf = MD_FENCE;
+	md->fence = c;
+	md->fence_len = n;
+	md->fence_indent = indent;
+	begin_block(md->out);
+
+	for (info = l->p + n; info < l->end && is_space(*info); ++info);
+	for (info_end = info; info_end < l->end && !is_space(*info_end);
+	    ++info_end);
+	if (info == info_end) {
+		buf_appends(md->out, "<pre><code>");
+		return;
+	}
+	buf_appends(md->out, "<pre><code class=\"language-");
+	escape_append(md->out, info, (size_t)(info_end - info));
+	buf_appends(md->out, "\">");
+}
+
+static void
+heading(struct markdown *md, struct line *l, int level)
+{
+	const char *p = l->p + level;
+	const char *end = l->end;
+	const char *q;
+
+	while (p < end && is_space(*p)) ++p;
+	while (end > p && is_space(end[-1])) --end;
+
+	/* a closing sequence of #s goes, if it is separate */
+	for (q = end; q > p && q[-1] == '#'; --q);
+	if (q == p || is_space(q[-1])) {
+		for (end = q; end > p && is_space(end[-1]); --end);
+	}
+
+	begin_block(md->out);
+	buf_appendf(md->out, "<h%d>", level);
+	render_inline(md->out, p, end);
+	buf_appendf(md->out, "</h%d>\n", level);
+}
+
+static void
+process_line(struct markdown *md, struct line *l)
+{
+	bool blank = is_blank(l);
+	size_t matched = match_containers(md, l, blank);
+	size_t indent;
+	const char *start;
+	size_t n;
+	char c;
+	int level;
+	int kind;
+
+	if (md->leaf == MD_FENCE) {
+		if (matched == md->depth) {
+			fence_line(md, l);
+			return;
+		}
+		close_leaf(md);
+	}
+	if (md->leaf == MD_HTML) {
+		if (matched == md->depth && (!blank || md->html <= 5)) {
+			buf_append(md->out, l->p, (size_t)(l->end - l->p));
+			buf_appends(md->out, "\n");
+			if (html_end(md->html, l->p, l->end)) close_leaf(md);
+			return;
+		}
+		close_leaf(md);
+	}
+
+	/* lazy continuation: a paragraph goes on without the markers */
+	if (md->leaf == MD_PARA && !md->para_done && !blank &&
+	    matched < md->depth && !starts_block(l)) {
+		skip_indent(l, SIZE_MAX - l->col);
+		buf_appends(&md->para, "\n");
+		buf_append(&md->para, l->p, (size_t)(l->end - l->p));
+		return;
+	}
+
+	/* a blank line inside a list which then goes on makes it loose */
+	if (!blank && md->blank) {
+		for (size_t i = 0; i < matched; ++i) {
+			if (md->stack[i].type == MD_LIST) {
+				md->stack[i].loose = true;
+			}
+		}
+	}
+	if ((md->para_done && !blank) || matched < md->depth) {
+		close_leaf(md);
+	}
+	close_containers(md, matched);
+
+	md->blank = blank;
+	if (blank) {
+		if (md->leaf == MD_PARA) {
+			md->para_done = true;
+		} else if (md->leaf == MD_CODE) {
+			++md->code_blanks;
+		}
+		return;
+	}
+
+	open_containers(md, l);
+	if (is_blank(l)) return;	/* an item with its content to come */
+
+	indent = indent_of(l);
+	if (indent >= 4 && md->leaf != MD_PARA) {
+		if (md->leaf != MD_CODE) {
+			close_leaf(md);
+			md->leaf = MD_CODE;
+			begin_block(md->out);
+			buf_appends(md->out, "<pre><code>");
+		}
+		for (; md->code_blanks > 0; --md->code_blanks) {
+			buf_appends(md->out, "\n");
+		}
+		skip_indent(l, 4);
+		escape_append(md->out, l->p, (size_t)(l->end - l->p));
+		buf_appends(md->out, "\n");
+		return;
+	}
+	if (md->leaf == MD_CODE) close_leaf(md);
+
+	start = l->p;
+	skip_indent(l, 3);
+
+	if ((n = fence_of(l, &c)) != 0) {
+		close_leaf(md);
+		open_fence(md, l, indent, c, n);
+	} else if ((level = heading_level(l)) != 0) {
+		close_leaf(md);
+		heading(md, l, level);
+	} else if (md->leaf == MD_PARA && (level = setext_level(l)) != 0) {
+		begin_block(md->out);
+		buf_appendf(md->out, "<h%d>", level);
+		md->leaf = MD_NONE;
+		while (md->para.len > 0 &&
+		    is_space(md->para.data[md->para.len - 1])) {
+			--md->para.len;
+		}
+		render_inline(md->out, md->para.data,
+		    md->para.data + md->para.len);
+		buf_appendf(md->out, "</h%d>\n", level);
+	} else if (is_rule(l)) {
+		close_leaf(md);
+		begin_block(md->out);
+		buf_appends(md->out, "<hr />\n");
+	} else if ((kind = html_start(l)) != 0 &&
+	    (kind != 7 || md->leaf != MD_PARA)) {
+		close_leaf(md);
+		md->leaf = MD_HTML;
+		md->html = kind;
+		begin_block(md->out);
+		buf_append(md->out, start, (size_t)(l->end - start));
+		buf_appends(md->out, "\n");
+		if (html_end(kind, l->p, l->end)) close_leaf(md);
+	} else if (md->leaf == MD_PARA) {
+		skip_indent(l, SIZE_MAX - l->col);
+		buf_appends(&md->para, "\n");
+		buf_append(&md->para, l->p, (size_t)(l->end - l->p));
+	} else {
+		close_leaf(md);
+		md->leaf = MD_PARA;
+		md->para.len = 0;
+		buf_append(&md->para, l->p, (size_t)(l->end - l->p));
+	}
+}
+
+/* Append the HTML for the markdown in src to out */
+void
+markdown_render(struct markdown *md, const char *src, size_t len,
+    struct buf *out)
+{
+	const char *p = src;
+	const char *end = src + len;
+	const char *nl;
+	struct line l;
+
+	md->depth = 0;
+	md->leaf = MD_NONE;
+	md->para_done = false;
+	md->blank = false;
+	md->code_blanks = 0;
+	md->out = out;
+
+	/* HTML is usually a little longer than its markdown */
+	buf_reserve(out, len + len / 4);
+
+	while (p < end) {
+		if ((nl = memchr(p, '\n', (size_t)(end - p))) == NULL) {
+			nl = end;
+		}
+		l.p = p;
+		l.end = nl;
+		l.col = 0;
+		if (l.end > l.p && l.end[-1] == '\r') --l.end;
+		process_line(md, &l);
+		p = nl < end ? nl + 1 : end;
+	}
+	close_containers(md, 0);
+	close_leaf(md);
+}
+
+void
+markdown_free(struct markdown *md)
+{
+	buf_free(&md->para);
+}
+
+/* Inline */
+
+static bool
+missing(const struct miss *m, const char *p, const char *end)
+{
+	return m->from != NULL && p >= m->from && end <= m->to;
+}
+
+static void
+set_missing(struct miss *m, const char *p, const char *end)
+{
+	/* one which takes in another is worth more than it */
+	if (m->from == NULL || end >= m->to || p >= m->to) {
+		m->from = p;
+		m->to = end;
+	}
+}
+
+/* Returns the end of the code span starting at p, or NULL */
+static const char *
+code_span_end(struct inline_state *in, const char *p, const char *end,
+    size_t *ticks)
+{
+	struct miss *m = NULL;
+	const char *q = p;
+	const char *start;
+	size_t n, k;
+
+	while (q < end && *q == '`') ++q;
+	n = (size_t)(q - p);
+	*ticks = n;
+
+	if (n <= INLINE_TICKS) {
+		m = &in->ticks[n - 1];
+		if (missing(m, q, end)) return NULL;
+	}
+	start = q;
+	while (q < end) {
+		if (*q != '`') {
+			++q;
+			continue;
+		}
+		for (k = 0; q < end && *q == '`'; ++q, ++k);
+		if (k == n) return q;
+	}
+	if (m != NULL) set_missing(m, start, end);
+	return NULL;
+}
+
+static const char *
+code_span(struct inline_state *in, const char *p, const char *end)
+{
+	struct buf *out = in->out;
+	const char *q;
+	const char *s, *e;
+	size_t n;
+
+	if ((q = code_span_end(in, p, end, &n)) == NULL) {
+		buf_append(out, p, n);
+		return p + n;
+	}
+
+	s = p + n;
+	e = q - n;
+	/* one space either side is dropped, if it isn't all spaces */
+	if (e - s >= 2 && (*s == ' ' || *s == '\n') &&
+	    (e[-1] == ' ' || e[-1] == '\n')) {
+		for (const char *t = s; t < e; ++t) {
+			if (*t != ' ' && *t != '\n') {
+				++s;
+				--e;
+				break;
+			}
+		}
+	}
+
+	if (!in->plain) buf_appends(out, "<code>");
+	while (s < e) {
+		const char *nl = memchr(s, '\n', (size_t)(e - s));
+
+		if (nl == NULL) nl = e;
+		escape_append(out, s, (size_t)(nl - s));
+		if (nl < e) buf_appends(out, " ");
+		s = nl + 1;
+	}
+	if (!in->plain) buf_appends(out, "</code>");
+	return q;
+}
+
+static bool
+is_ws(char c)
+{
+	return c == ' ' || c == '\t' || c == '\n';
+}
+
+/* Find a run of exactly n c's which can close emphasis */
+static const char *
+find_closer(struct inline_state *in, const char *p, const char *end, char c,
+    size_t n)
+{
+	struct miss *m = &in->emphasis[c == '_'][n - 1];
+	const char *start = p;
+	const char *q;
+	size_t run;
+
+	if (missing(m, p, end)) return NULL;
+	while (p < end) {
+		if (*p == '\\' && p + 1 < end) {
+			p += 2;
+		} else if (*p == '`') {
+			q = code_span_end(in, p, end, &run);
+			p = q != NULL ? q : p + run;
+		} else if (*p == c) {
+			for (q = p; q < end && *q == c; ++q);
+			if ((size_t)(q - p) == n && !is_ws(p[-1]) &&
+			    (c != '_' || q == end ||
+			    !isalnum((unsigned char)*q))) {
+				return p;
+			}
+			p = q;
+		} else {
+			++p;
+		}
+	}
+	set_missing(m, start, end);
+	return NULL;
+}
+
+static const char *
+emphasis(struct inline_state *in, const char *start, const char *p,
+    const char *end)
+{
+	static const char *const open[] = { "<em>", "<strong>",
+	    "<em><strong>" };
+	static const char *const close[] = { "</em>", "</strong>",
+	    "</strong></em>" };
+	struct buf *out = in->out;
+	const char *q;
+	const char *closer;
+	char before = p > start ? p[-1] : ' ';
+	size_t n;
+
+	for (q = p; q < end && *q == *p; ++q);
+	n = (size_t)(q - p);
+
+	if (n > 3 || q == end || is_ws(*q) || in->depth == INLINE_DEPTH ||
+	    (*p == '_' && isalnum((unsigned char)before)) ||
+	    (closer = find_closer(in, q, end, *p, n)) == NULL) {
+		buf_append(out, p, n);
+		return q;
+	}
+
+	if (!in->plain) buf_appends(out, open[n - 1]);
+	++in->depth;
+	render_spans(in, q, closer);
+	--in->depth;
+	if (!in->plain) buf_appends(out, close[n - 1]);
+	return closer + n;
+}
+
+static const char *
+skip_ws(const char *p, const char *end)
+{
+	while (p < end && is_ws(*p)) ++p;
+	return p;
+}
+
+/*
+ * Parse [text](destination "title") from p, which is at the [. Brackets
+ * and parentheses nested deeper than INLINE_DEPTH aren't a link: that
+ * bounds how many of these can be looking through any part of the text.
+ */
+static bool
+parse_link(struct inline_state *in, const char *p, const char *end,
+    struct link *lk)
+{
+	const char *q = p + 1;
+	const char *s;
+	size_t depth = 1;
+	size_t parens = 0;
+	size_t run;
+	char closing;
+
+	while (q < end) {
+		if (*q == '\\' && q + 1 < end) {
+			q += 2;
+			continue;
+		}
+		if (*q == '`') {
+			s = code_span_end(in, q, end, &run);
+			q = s != NULL ? s : q + run;
+			continue;
+		}
+		if (*q == '[') {
+			if (++depth > INLINE_DEPTH) return false;
+		} else if (*q == ']' && --depth == 0) {
+			break;
+		}
+		++q;
+	}
+	if (q >= end) return false;
+	lk->text = p + 1;
+	lk->text_end = q++;
+
+	if (q >= end || *q != '(') return false;
+	q = skip_ws(q + 1, end);
+
+	/* there's no < in <destination>, and no ( in a (title) */
+	if (q < end && *q == '<') {
+		lk->dest = ++q;
+		while (q < end && *q != '>' && *q != '<' && *q != '\n') {
+			q += *q == '\\' && q + 1 < end &&
+			    ispunct((unsigned char)q[1]) ? 2 : 1;
+		}
+		if (q >= end || *q != '>') return false;
+		lk->dest_end = q++;
+	} else {
+		lk->dest = q;
+		while (q < end && !is_ws(*q) &&
+		    !iscntrl((unsigned char)*q)) {
+			if (*q == '\\' && q + 1 < end) {
+				q += 2;
+				continue;
+			}
+			if (*q == '(') {
+				if (++parens > INLINE_DEPTH) return false;
+			} else if (*q == ')' && parens-- == 0) {
+				break;
+			}
+			++q;
+		}
+		lk->dest_end = q;
+	}
+
+	s = q;
+	q = skip_ws(q, end);
+	lk->title = NULL;
+	lk->title_end = NULL;
+	if (q > s && q < end && (*q == '"' || *q == '\'' || *q == '(')) {
+		closing = *q == '(' ? ')' : *q;
+		lk->title = ++q;
+		while (q < end && *q != closing) {
+			if (closing == ')' && *q == '(') return false;
+			q += *q == '\\' && q + 1 < end ? 2 : 1;
+		}
+		if (q >= end) return false;
+		lk->title_end = q;
+		q = skip_ws(q + 1, end);
+	}
+
+	if (q >= end || *q != ')') return false;
+	lk->next = q + 1;
+	return true;
+}
+
+static int
+compare_names(const void *v1, const void *v2)
+{
+	return strcmp(v1, *(const char *const *)v2);
+}
+
+/* The length of the entity or character reference at p, or 0 */
+static size_t
+reference(const char *p, const char *end)
+{
+	const char *q = p + 1;
+	const char *s;
+	char name[32];
+	size_t max = sizeof(name) - 1;
+	int (*valid)(int) = isalnum;
+
+	if (q < end && *q == '#') {
+		++q;
+		valid = isdigit;
+		max = 7;
+		if (q < end && (*q == 'x' || *q == 'X')) {
+			++q;
+			valid = isxdigit;
+			max = 6;
+		}
+	} else if (q >= end || !isalpha((unsigned char)*q)) {
+		return 0;
+	}
+	for (s = q; s < end && (size_t)(s - q) < max &&
+	    valid((unsigned char)*s); ++s);
+	if (s == q || s >= end || *s != ';') return 0;
+
+	/* only the names HTML has are entities */
+	if (valid == isalnum) {
+		memcpy(name, q, (size_t)(s - q));
+		name[s - q] = '\0';
+		if (bsearch(name, entities, sizeof(entities) /
+		    sizeof(entities[0]), sizeof(entities[0]),
+		    compare_names) == NULL) {
+			return 0;
+		}
+	}
+	return (size_t)(s + 1 - p);
+}
+
+/* Characters which go into a URL as they are */
+static bool
+url_char(char c)
+{
+	return isalnum((unsigned char)c) ||
+	    (c != '\0' && strchr("-_.+!*'(),%#@?=;:/$~&", c) != NULL);
+}
+
+/* Part of a URL, percent-encoding whatever can't be in one */
+static void
+url_append(struct buf *out, const char *p, size_t len)
+{
+	const char *end = p + len;
+	const char *run;
+
+	while (p < end) {
+		for (run = p; p < end && url_char(*p); ++p);
+		escape_append(out, run, (size_t)(p - run));
+		if (p < end) {
+			buf_appendf(out, "%%%02X", (unsigned char)*p++);
+		}
+	}
+}
+
+/*
+ * Text for an attribute, with backslash escapes taken out but entities
+ * kept, and if it is a URL, what can't be in one percent-encoded
+ */
+static void
+attribute(struct buf *out, const char *p, const char *end, bool url)
+{
+	void (*append)(struct buf *, const char *, size_t) =
+	    url ? url_append : escape_append;
+	const char *run = p;
+	size_t n;
+
+	for (; p < end; ++p) {
+		if (*p == '\\' && p + 1 < end &&
+		    ispunct((unsigned char)p[1])) {
+			append(out, run, (size_t)(p - run));
+			run = ++p;
+		} else if (*p == '&' && (n = reference(p, end)) > 0) {
+			append(out, run, (size_t)(p - run));
+			buf_append(out, p, n);
+			p += n - 1;
+			run = p + 1;
+		}
+	}
+	append(out, run, (size_t)(p - run));
+}
+
+static void
+title_attribute(struct buf *out, const struct link *lk)
+{
+	if (lk->title == NULL) return;
+	buf_appends(out, " title=\"");
+	attribute(out, lk->title, lk->title_end, false);
+	buf_appends(out, "\"");
+}
+
+static const char *
+link(struct inline_state *in, const char *p, const char *end, bool image)
+{
+	struct buf *out = in->out;
+	struct link lk;
+
+	if (in->depth == INLINE_DEPTH ||
+	    !parse_link(in, image ? p + 1 : p, end, &lk)) {
+		buf_append(out, p, image ? 2 : 1);
+		return p + (image ? 2 : 1);
+	}
+
+	++in->depth;
+	if (in->plain) {
+		/* inside an alt, a link or image is only its text */
+		render_spans(in, lk.text, lk.text_end);
+	} else if (image) {
+		buf_appends(out, "<img src=\"");
+		attribute(out, lk.dest, lk.dest_end, true);
+		buf_appends(out, "\" alt=\"");
+		in->plain = true;
+		render_spans(in, lk.text, lk.text_end);
+		in->plain = false;
+		buf_appends(out, "\"");
+		title_attribute(out, &lk);
+		buf_appends(out, " />");
+	} else {
+		buf_appends(out, "<a href=\"");
+		attribute(out, lk.dest, lk.dest_end, true);
+		buf_appends(out, "\"");
+		title_attribute(out, &lk);
+		buf_appends(out, ">");
+		render_spans(in, lk.text, lk.text_end);
+		buf_appends(out, "</a>");
+	}
+	--in->depth;
+	return lk.next;
+}
+
+/* Where the > ending some raw HTML is, or NULL */
+static const char *
+tag_end(struct inline_state *in, const char *p, const char *end)
+{
+	const char *q;
+
+	if (missing(&in->tag_end, p, end)) return NULL;
+	if ((q = memchr(p, '>', (size_t)(end - p))) == NULL) {
+		set_missing(&in->tag_end, p, end);
+	}
+	return q;
+}
+
+static void
+raw_html(struct inline_state *in, const char *p, const char *end)
+{
+	if (in->plain) {
+		escape_append(in->out, p, (size_t)(end - p));
+	} else {
+		buf_append(in->out, p, (size_t)(end - p));
+	}
+}
+
+/* An autolink, some raw HTML, or just a < */
+static const char *
+angle(struct inline_state *in, const char *p, const char *end)
+{
+	struct buf *out = in->out;
+	const char *q = p + 1;
+	const char *s;
+	bool mail;
+
+	/* <scheme:...> or <user@host> */
+	for (s = q; s < end && (isalnum((unsigned char)*s) ||
+	    strchr("+.-_", *s) != NULL); ++s);
+	mail = s < end && *s == '@';
+	if (s < end && s - q >= 2 && (*s == ':' || mail) &&
+	    isalpha((unsigned char)*q)) {
+		for (++s; s < end && *s != '>' && *s != '<' && !is_ws(*s) &&
+		    !iscntrl((unsigned char)*s); ++s);
+		if (s < end && *s == '>' && in->plain) {
+			escape_append(out, q, (size_t)(s - q));
+			return s + 1;
+		}
+		if (s < end && *s == '>') {
+			buf_appends(out, mail ? "<a href=\"mailto:" :
+			    "<a href=\"");
+			url_append(out, q, (size_t)(s - q));
+			buf_appends(out, "\">");
+			escape_append(out, q, (size_t)(s - q));
+			buf_appends(out, "</a>");
+			return s + 1;
+		}
+	}
+
+	/* a tag, closing tag, comment or the like */
+	s = q;
+	if (s < end && *s == '/') ++s;
+	if (s < end && isalpha((unsigned char)*s)) {
+		while (s < end && (isalnum((unsigned char)*s) || *s == '-')) {
+			++s;
+		}
+		if (s < end && (is_ws(*s) || *s == '/' || *s == '>') &&
+		    (s = tag_end(in, s, end)) != NULL) {
+			raw_html(in, p, s + 1);
+			return s + 1;
+		}
+	} else if (s == q && s < end && (*s == '!' || *s == '?') &&
+	    (s = tag_end(in, s, end)) != NULL) {
+		raw_html(in, p, s + 1);
+		return s + 1;
+	}
+
+	buf_appends(out, "&lt;");
+	return p + 1;
+}
+
+/* An entity or character reference is kept, any other & escaped */
+static const char *
+entity(struct buf *out, const char *p, const char *end)
+{
+	size_t n;
+
+	if ((n = reference(p, end)) > 0) {
+		buf_append(out, p, n);
+		return p + n;
+	}
+	buf_appends(out, "&amp;");
+	return p + 1;
+}
+
+static void
+render_spans(struct inline_state *in, const char *p, const char *end)
+{
+	struct buf *out = in->out;
+	const char *start = p;
+	const char *run;
+	size_t spaces;
+
+	while (p < end) {
+		for (run = p; p < end &&
+		    !inline_special[(unsigned char)*p]; ++p);
+		escape_append(out, run, (size_t)(p - run));
+		if (p >= end) break;
+
+		switch (*p) {
+			case '\n':
+				/* two spaces at the end of a line break it */
+				for (spaces = 0; out->len > 0 &&
+				    out->data[out->len - 1] == ' '; ++spaces) {
+					--out->len;
+				}
+				out->data[out->len] = '\0';
+				if (in->plain) {
+					buf_appends(out, " ");
+				} else {
+					buf_appends(out, spaces >= 2 ?
+					    "<br />\n" : "\n");
+				}
+				++p;
+				break;
+			case '\\':
+				if (p + 1 < end && p[1] == '\n') {
+					buf_appends(out, in->plain ?
+					    " " : "<br />\n");
+					p += 2;
+				} else if (p + 1 < end &&
+				    ispunct((unsigned char)p[1])) {
+					escape_append(out, p + 1, 1);
+					p += 2;
+				} else {
+					buf_appends(out, "\\");
+					++p;
+				}
+				break;
+			case '`':
+				p = code_span(in, p, end);
+				break;
+			case '*':
+			case '_':
+				p = emphasis(in, start, p, end);
+				break;
+			case '!':
+				if (p + 1 < end && p[1] == '[') {
+					p = link(in, p, end, true);
+				} else {
+					buf_appends(out, "!");
+					++p;
+				}
+				break;
+			case '[':
+				p = link(in, p, end, false);
+				break;
+			case '<':
+				p = angle(in, p, end);
+				break;
+			case '&':
+				p = entity(out, p, end);
+				break;
+		}
+	}
+}
+
+static void
+render_inline(struct buf *out, const char *p, const char *end)
+{
+	struct inline_state in = {0};
+
+	in.out = out;
+	render_spans(&in, p, end);
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2015 Scarletts <scarlett@entering.space>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef MARKDOWN_H
+#define MARKDOWN_H
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "buf.h"
+
+#define MARKDOWN_DEPTH	32	/* nested lists and quotes, deeper is text */
+
+enum md_container {
+	MD_QUOTE,
+	MD_LIST,
+	MD_ITEM
+};
+
+enum md_leaf {
+	MD_NONE,
+	MD_PARA,
+	MD_FENCE,
+	MD_CODE,
+	MD_HTML
+};
+
+struct md_block {
+	enum md_container type;
+	char marker;		/* list: -, + or *, or . or ) if ordered */
+	bool loose;		/* list: its paragraphs get <p> */
+	size_t indent;		/* item: the column its content starts at */
+};
+
+/*
+ * Everything needed between lines, kept from one page to the next so
+ * that rendering allocates nothing once the buffers are big enough.
+ */
+struct markdown {
+	struct md_block stack[MARKDOWN_DEPTH];
+	size_t depth;
+	enum md_leaf leaf;
+	struct buf para;	/* the text of the open paragraph */
+	bool para_done;		/* a blank line ended it */
+	bool blank;		/* the last line was blank */
+	char fence;
+	size_t fence_len;
+	size_t fence_indent;
+	size_t code_blanks;	/* held back until the code block goes on */
+	int html;		/* which kind of HTML block, see html_start() */
+	struct buf *out;
+};
+
+void markdown_render(struct markdown *, const char *, size_t, struct buf *);
+
+void markdown_free(struct markdown *);
+
+#endif
@@ -0,0 +1,434 @@
+/*
+ * Copyright (c) 2015 Scarletts <scarlett@entering.space>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Writes the files in the build directory. A file is left alone when its
+ * contents wouldn't change, so its mtime stays put and syncing the site
+ * only has to send what changed. Otherwise it is written to a temporary
+ * file which is renamed over it, so a half-written page is never visible.
+ *
+ * Everything created, changed or removed is recorded, and written out as
+ * a list for deploying just the difference:
+ *
+ *	A path		created
+ *	M path		changed
+ *	D path		removed
+ *
+ * with paths relative to the build directory.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+
+#include "xalloc.h"
+#include "util.h"
+#include "output.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX 16	/* _XOPEN_IOV_MAX, the least any system allows */
+#endif
+
+struct change {
+	char type;
+	char *path;
+};
+
+static struct {
+	const char *root;
+	size_t root_len;
+	mode_t mode;
+	struct change *changes;
+	size_t count;
+	size_t bufsize;
+	pthread_mutex_t lock;
+} o = {
+	.lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+void
+output_init(const char *root)
+{
+	mode_t mask;
+
+	o.root = root;
+	o.root_len = strlen(root);
+
+	/* mkstemp() ignores the umask, but the output should respect it */
+	mask = umask(0);
+	umask(mask);
+	o.mode = (S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH) &
+	    ~mask;
+}
+
+static void
+record(char type, const char *path)
+{
+	/* paths are recorded relative to the build directory */
+	if (strncmp(path, o.root, o.root_len) == 0 && path[o.root_len] == '/') {
+		path += o.root_len + 1;
+	}
+
+	pthread_mutex_lock(&o.lock);
+	if (o.count >= o.bufsize) {
+		o.bufsize = o.bufsize == 0 ? 64 : o.bufsize * 2;
+		o.changes = xreallocarray(o.changes, o.bufsize,
+		    sizeof(struct change));
+	}
+	o.changes[o.count].type = type;
+	o.changes[o.count].path = xstrdup(path);
+	++o.count;
+	pthread_mutex_unlock(&o.lock);
+}
+
+static bool
+same_contents(int fd, off_t size, const struct iovec *iov, int iovcnt)
+{
+	char *map;
+	size_t off = 0;
+	bool same = true;
+
+	if (size == 0) return true;
+
+	map = mmap(NULL, (size_t)size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) return false;
+
+	for (int i = 0; i < iovcnt && same; ++i) {
+		same = memcmp(map + off, iov[i].iov_base, iov[i].iov_len) == 0;
+		off += iov[i].iov_len;
+	}
+	munmap(map, (size_t)size);
+	return same;
+}
+
+static int
+write_tmp(int fd, const struct iovec *iov, int iovcnt)
+{
+	for (int i = 0; i < iovcnt; i += IOV_MAX) {
+		int n = iovcnt - i < IOV_MAX ? iovcnt - i : IOV_MAX;
+		ssize_t ret;
+
+		if ((ret = writev(fd, iov + i, n)) == -1) {
+			if (errno != EINTR) {
+				perror("writev");
+				return -1;
+			}
+			ret = 0;
+		}
+
+		/* writev() may stop short, finish the rest piece by piece */
+		for (int j = i; j < i + n; ++j) {
+			size_t done = (size_t)ret < iov[j].iov_len ?
+			    (size_t)ret : iov[j].iov_len;
+
+			ret -= (ssize_t)done;
+			if (done < iov[j].iov_len &&
+			    write_fully(fd, (char *)iov[j].iov_base + done,
+			    iov[j].iov_len - done) == -1) {
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+static int
+open_tmp(const char *path, char **tmp)
+{
+	int fd;
+
+	xasprintf(tmp, "%s.XXXXXX", path);
+	if ((fd = make_temp(*tmp)) == -1) {
+		perror(*tmp);
+		free(*tmp);
+		*tmp = NULL;
+		return -1;
+	}
+	if (fchmod(fd, o.mode) == -1) {
+		perror("fchmod");
+		close(fd);
+		unlink(*tmp);
+		free(*tmp);
+		*tmp = NULL;
+		return -1;
+	}
+	return fd;
+}
+
+int
+output_writev(const char *path, const struct iovec *iov, int iovcnt)
+{
+	int fd;
+	int ret = 0;
+	char *tmp = NULL;
+	off_t total = 0;
+	struct stat st;
+	bool exists;
+
+	for (int i = 0; i < iovcnt; ++i) {
+		total += (off_t)iov[i].iov_len;
+	}
+
+	if ((fd = open(path, O_RDONLY)) != -1) {
+		bool same = fstat(fd, &st) == 0 && st.st_size == total &&
+		    same_contents(fd, total, iov, iovcnt);
+
+		close(fd);
+		if (same) return 0;
+		exists = true;
+	} else {
+		exists = false;
+	}
+
+	if ((fd = open_tmp(path, &tmp)) == -1) {
+		return -1;
+	}
+	if (write_tmp(fd, iov, iovcnt) == -1) {
+		ret = -1;
+	}
+	if (close(fd) == -1) {
+		perror("close");
+		ret = -1;
+	}
+	if (ret == 0 && rename(tmp, path) == -1) {
+		perror("rename");
+		ret = -1;
+	}
+	if (ret == -1) {
+		unlink(tmp);
+	} else {
+		record(exists ? 'M' : 'A', path);
+	}
+	free(tmp);
+	return ret;
+}
+
+int
+output_write(const char *path, const char *data, size_t len)
+{
+	struct iovec iov;
+
+	iov.iov_base = (void *)data;
+	iov.iov_len = len;
+	return output_writev(path, &iov, 1);
+}
+
+/*
+ * For output that is written bit by bit rather than handed over all at
+ * once: it goes into out->fd, and is only compared against the existing
+ * file by output_close().
+ */
+int
+output_open(struct output_file *out, const char *path)
+{
+	out->path = path;
+	out->fd = open_tmp(path, &out->tmp);
+	return out->fd == -1 ? -1 : 0;
+}
+
+void
+output_discard(struct output_file *out)
+{
+	close(out->fd);
+	unlink(out->tmp);
+	free(out->tmp);
+	out->tmp = NULL;
+}
+
+int
+output_close(struct output_file *out)
+{
+	int fd;
+	int ret = 0;
+	char *map = NULL;
+	struct stat st;
+	struct stat old;
+	struct iovec iov;
+	bool exists = false;
+	bool same = false;
+
+	if (fstat(out->fd, &st) == -1) {
+		perror("fstat");
+		output_discard(out);
+		return -1;
+	}
+
+	if ((fd = open(out->path, O_RDONLY)) != -1) {
+		exists = true;
+		if (fstat(fd, &old) == 0 && old.st_size == st.st_size) {
+			if (st.st_size > 0) {
+				map = mmap(NULL, (size_t)st.st_size, PROT_READ,
+				    MAP_PRIVATE, out->fd, 0);
+			}
+			if (map != MAP_FAILED) {
+				iov.iov_base = map;
+				iov.iov_len = (size_t)st.st_size;
+				same = same_contents(fd, st.st_size, &iov, 1);
+			}
+			if (map != NULL && map != MAP_FAILED) {
+				munmap(map, (size_t)st.st_size);
+			}
+		}
+		close(fd);
+	}
+
+	if (close(out->fd) == -1) {
+		perror("close");
+		ret = -1;
+	}
+	if (ret == 0 && !same && rename(out->tmp, out->path) == -1) {
+		perror("rename");
+		ret = -1;
+	}
+	if (ret == -1 || same) {
+		unlink(out->tmp);
+	} else {
+		record(exists ? 'M' : 'A', out->path);
+	}
+	free(out->tmp);
+	out->tmp = NULL;
+	return ret;
+}
+
+void
+output_removed(const char *path)
+{
+	record('D', path);
+}
+
+static int
+compare_strings(const void *v1, const void *v2)
+{
+	return strcmp(*(char *const *)v1, *(char *const *)v2);
+}
+
+/*
+ * Compare the outputs of this build against those listed by the last one,
+ * removing those which are no longer produced, then list the current ones
+ * for next time. The current outputs are sorted in place.
+ */
+int
+output_sweep(const char *list_path, char **current, size_t count)
+{
+	FILE *fp;
+	char *text;
+	char *line, *next;
+	char *tmp = NULL;
+	int ret = 0;
+
+	qsort(current, count, sizeof(char *), compare_strings);
+
+	if (access(list_path, F_OK) == 0 &&
+	    (text = read_file(list_path, NULL)) != NULL) {
+		for (line = text; *line != '\0'; line = next + 1) {
+			char *path = NULL;
+
+			if ((next = strchr(line, '\n')) == NULL) break;
+			*next = '\0';
+
+			if (bsearch(&line, current, count, sizeof(char *),
+			    compare_strings) != NULL) {
+				continue;
+			}
+			xasprintf(&path, "%s/%s", o.root, line);
+			if (unlink(path) == 0) {
+				record('D', path);
+			} else if (errno != ENOENT) {
+				perror(path);
+			}
+			free(path);
+		}
+		free(text);
+	}
+
+	xasprintf(&tmp, "%s.tmp", list_path);
+	if ((fp = fopen(tmp, "w")) == NULL) {
+		perror(tmp);
+		free(tmp);
+		return -1;
+	}
+	for (size_t i = 0; i < count && ret == 0; ++i) {
+		if (fprintf(fp, "%s\n", current[i]) < 0) {
+			perror("fprintf");
+			ret = -1;
+		}
+	}
+	if (fclose(fp) != 0) {
+		perror("fclose");
+		ret = -1;
+	}
+	if (ret == 0 && rename(tmp, list_path) == -1) {
+		perror("rename");
+		ret = -1;
+	}
+	free(tmp);
+	return ret;
+}
+
+/*
+ * Write the list of changes since the last report, as described above,
+ * then start a new one for the next build.
+ */
+int
+output_report(const char *path)
+{
+	FILE *fp;
+	char *tmp = NULL;
+	int ret = 0;
+
+	xasprintf(&tmp, "%s.tmp", path);
+	if ((fp = fopen(tmp, "w")) == NULL) {
+		perror(tmp);
+		free(tmp);
+		return -1;
+	}
+	pthread_mutex_lock(&o.lock);
+	for (size_t i = 0; i < o.count && ret == 0; ++i) {
+		if (fprintf(fp, "%c %s\n", o.changes[i].type,
+		    o.changes[i].path) < 0) {
+			perror("fprintf");
+			ret = -1;
+		}
+	}
+	for (size_t i = 0; i < o.count; ++i) {
+		free(o.changes[i].path);
+	}
+	o.count = 0;
+	pthread_mutex_unlock(&o.lock);
+	if (fclose(fp) != 0) {
+		perror("fclose");
+		ret = -1;
+	}
+	if (ret == 0 && rename(tmp, path) == -1) {
+		perror("rename");
+		ret = -1;
+	}
+	if (ret == -1) {
+		unlink(tmp);
+	}
+	free(tmp);
+	return ret;
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2015 Scarletts <scarlett@entering.space>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef OUTPUT_H
+#define OUTPUT_H
+#include <sys/uio.h>
+#include <stddef.h>
+
+struct output_file {
+	const char *path;
+	char *tmp;
+	int fd;
+};
+
+void output_init(const char *);
+
+int output_writev(const char *, const struct iovec *, int);
+
+int output_write(const char *, const char *, size_t);
+
+int output_open(struct output_file *, const char *);
+
+int output_close(struct output_file *);
+
+void output_discard(struct output_file *);
+
+void output_removed(const char *);
+
+int output_sweep(const char *, char **, size_t);
+
+int output_report(const char *);
+
+#endif
@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2015 Scarletts <scarlett@entering.space>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Parsers loaded with dlopen(3), as described in pswg-plugin.h.
+ */
+
+#include <dlfcn.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "buf.h"
+#include "plugin.h"
+
+/* Whether a parser given to -p names a plugin rather than a program */
+bool
+plugin_named(const char *parser)
+{
+	size_t len = strlen(parser);
+
+	return len > 3 && strcmp(parser + len - 3, ".so") == 0;
+}
+
+int
+plugin_load(struct plugin *pl, const char *path)
+{
+	pl->api = NULL;
+	if ((pl->handle = dlopen(path, RTLD_NOW | RTLD_LOCAL)) == NULL) {
+		fprintf(stderr, "%s\n", dlerror());
+		return -1;
+	}
+	if ((pl->api = dlsym(pl->handle, "pswg_plugin")) == NULL) {
+		fprintf(stderr, "%s: no pswg_plugin defined\n", path);
+		goto error;
+	}
+	if (pl->api->version != PSWG_PLUGIN_VERSION) {
+		fprintf(stderr, "%s: built for plugin version %d, not %d\n",
+		    path, pl->api->version, PSWG_PLUGIN_VERSION);
+		goto error;
+	}
+	if (pl->api->render == NULL) {
+		fprintf(stderr, "%s: no render function\n", path);
+		goto error;
+	}
+	if (pl->api->init != NULL && pl->api->init() == -1) {
+		fprintf(stderr, "%s: failed to initialise\n", path);
+		goto error;
+	}
+	pthread_mutex_init(&pl->lock, NULL);
+	return 0;
+
+error:
+	dlclose(pl->handle);
+	pl->handle = NULL;
+	pl->api = NULL;
+	return -1;
+}
+
+static void
+emit(struct pswg_output *out, const char *data, size_t len)
+{
+	buf_append(out->priv, data, len);
+}
+
+/* Append what the plugin renders src as to b */
+int
+plugin_render(struct plugin *pl, const char *src, size_t len,
+    const char *path, struct buf *b)
+{
+	struct pswg_output out;
+	bool serial = !(pl->api->flags & PSWG_PLUGIN_THREADSAFE);
+	int ret;
+
+	out.emit = emit;
+	out.priv = b;
+
+	if (serial) pthread_mutex_lock(&pl->lock);
+	ret = pl->api->render(src, len, path, &out);
+	if (serial) pthread_mutex_unlock(&pl->lock);
+
+	if (ret != 0) {
+		fprintf(stderr, "%s: plugin failed to render it\n", path);
+		return -1;
+	}
+
+	/* even if it never emitted anything, the result is a string */
+	buf_reserve(b, 0);
+	b->data[b->len] = '\0';
+	return 0;
+}
+
+void
+plugin_unload(struct plugin *pl)
+{
+	if (pl->handle == NULL) return;
+
+	if (pl->api->finalize != NULL) {
+		pl->api->finalize();
+	}
+	pthread_mutex_destroy(&pl->lock);
+	dlclose(pl->handle);
+	pl->handle = NULL;
+	pl->api = NULL;
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2015 Scarletts <scarlett@entering.space>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Adapts an ordinary parser, which takes a file as its last argument and
+ * prints HTML to stdout, to the coprocess protocol used by pswg -P. Each
+ * page received is written to a temporary file and the parser is run on
+ * it, so this saves nothing by itself, but shows what a parser needs to
+ * do to speak the protocol.
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "xalloc.h"
+#include "util.h"
+#include "coproc.h"
+#include "spawn.h"
+
+int
+main(int argc, char **argv)
+{
+	int ret = 0;
+	int fd = -1;
+	int eof;
+	const char *tmpdir;
+	char *tmp = NULL;
+	char **args = NULL;
+	char *src = NULL;
+	char *out = NULL;
+	size_t len;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s parser [argument ...]\n", argv[0]);
+		return 1;
+	}
+
+	if ((tmpdir = getenv("TMPDIR")) == NULL || *tmpdir == '\0') {
+		tmpdir = "/tmp";
+	}
+	xasprintf(&tmp, "%s/pswg-coproc.XXXXXX", tmpdir);
+	if ((fd = mkstemp(tmp)) == -1) {
+		perror("mkstemp");
+		free(tmp);
+		return 1;
+	}
+
+	args = xreallocarray(NULL, (size_t)argc + 1, sizeof(char *));
+	for (int i = 1; i < argc; ++i) {
+		args[i - 1] = argv[i];
+	}
+	args[argc - 1] = tmp;
+	args[argc] = NULL;
+
+	for (;;) {
+		if ((src = frame_read(STDIN_FILENO, &len, &eof)) == NULL) {
+			if (!eof) goto error;
+			break;
+		}
+		if (ftruncate(fd, 0) == -1) {
+			perror("ftruncate");
+			goto error;
+		}
+		if (lseek(fd, 0, SEEK_SET) == -1) {
+			perror("lseek");
+			goto error;
+		}
+		if (write_fully(fd, src, len) == -1) goto error;
+		free(src);
+		src = NULL;
+
+		if ((out = read_pipe(args, &len)) == NULL) goto error;
+		if (frame_write(STDOUT_FILENO, out, len) == -1) goto error;
+		free(out);
+		out = NULL;
+	}
+
+end:
+	close(fd);
+	unlink(tmp);
+	free(tmp);
+	free(args);
+	free(src);
+	free(out);
+	return ret;
+error:
+	ret = 1;
+	goto end;
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2015 Scarletts <scarlett@entering.space>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef PSWG_PLUGIN_H
+#define PSWG_PLUGIN_H
+#include <stddef.h>
+
+/*
+ * A parser built as a shared object, which pswg loads when the parser
+ * given to -p ends in .so, so that rendering a page is a function call
+ * rather than a process. The object defines
+ *
+ *	const struct pswg_plugin pswg_plugin = {
+ *		PSWG_PLUGIN_VERSION, flags, init, render, finalize
+ *	};
+ *
+ * init is called once before the first page and finalize once after the
+ * last, and either may be NULL; init returns 0, or -1 if the plugin can't
+ * be used. render is given the source of a page and the path it was read
+ * from, and passes the HTML to out->emit() in as many pieces as it likes.
+ * It returns 0, or -1 if the page can't be rendered, having said why on
+ * stderr.
+ *
+ * Unless flags include PSWG_PLUGIN_THREADSAFE, only one page is rendered
+ * at a time, whatever the number of jobs.
+ */
+
+#define PSWG_PLUGIN_VERSION	1	/* changes when the structs below do */
+
+#define PSWG_PLUGIN_THREADSAFE	0x1	/* render may run in several threads */
+
+struct pswg_output {
+	void (*emit)(struct pswg_output *, const char *, size_t);
+	void *priv;	/* pswg's */
+};
+
+struct pswg_plugin {
+	int version;
+	unsigned int flags;
+	int (*init)(void);
+	int (*render)(const char *, size_t, const char *,
+	    struct pswg_output *);
+	void (*finalize)(void);
+};
+
+#endif
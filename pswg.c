@@ -18,30 +18,97 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#include <signal.h>
 #include <time.h>
-#include <ftw.h>
 #include <pwd.h>
 
 #include "xalloc.h"
 #include "util.h"
-
+#include "template.h"
+#include "coproc.h"
+#include "spawn.h"
+#include "hash.h"
+#include "manifest.h"
+#include "cache.h"
+#include "dates.h"
+#include "escape.h"
+#include "markdown.h"
+#include "plugin.h"
+#include "search.h"
+#include "walk.h"
+#include "stats.h"
+#include "watch.h"
+#include "output.h"
+#include "buf.h"
+
+#define NEWS_PAGES	10	/* defaults for -N and -F */
+#define FEED_PAGES	20
+#define ARCHIVE_ROWS	500	/* most pages listed on one archive page */
+
+/* Dates are only formatted when something shows them, see format_date() */
 struct page {
 	char *htpath;
 	char *title;
 	char *body;
 	size_t body_len;
 	time_t created;
-	char *created_iso;
-	char *created_readable;
 	time_t modified;
-	char *modified_iso;
-	char *modified_readable;
-	char *user;
+	const char *user;
+	uint64_t hash;
+	size_t found;	/* order, see compare_page_dates() */
+	off_t out_size;
+	size_t body_off;
+	size_t body_map;
+	size_t excerpt_off;	/* what the news shows, see find_excerpt() */
+	size_t excerpt_end;
+	bool excerpt_more;
+	bool clean;
+	bool cached;
+	bool stream;	/* body goes straight into the output */
+	struct search_terms terms;	/* with -i */
+};
+
+/* A date formatted both ways the pages show it */
+struct date_str {
+	char iso[32];
+	char readable[32];
+};
+
+/* Owners' names are looked up once per uid */
+struct owner {
+	uid_t uid;
+	const char *name;
+};
+
+/* One page of the archive: a year, or part of one if it is long */
+struct archive_shard {
+	int year;
+	size_t part;	/* from 1 */
+	size_t parts;
+	size_t start;	/* the pages it lists, in date order */
+	size_t end;
+	char name[64];	/* relative to build */
+};
+
+/* A page waiting to be rendered */
+struct work {
+	char *path;
+	const char *rel;	/* within path, relative to src */
+	struct stat st;
+};
+
+/* What each rendering thread has to itself */
+struct worker {
+	struct coproc *cp;	/* with -P */
+	struct markdown md;	/* with -m */
+	struct buf out;
+	struct search_scratch search;	/* with -i */
 };
 
 struct context {
@@ -49,10 +116,53 @@ struct context {
 	const char *base_url;
 	const char *parser;
 	const char *feed_title;
-	struct page *pages;
-	size_t page_bufsize;
+	struct coproc *coprocs;
+	struct worker *workers;
+	struct plugin plugin;
+	struct template header;
+	struct template footer;
+	struct dates dates;
+	struct manifest manifest;
+	struct search_store search_store;	/* with -i */
+	uint64_t inputs;
+	unsigned long long cache_size;
+	bool use_cache;
+	struct work *work;
+	size_t work_bufsize;
+	size_t work_count;
+	size_t found;		/* pages so far, to number the next */
+	size_t work_next;
+	pthread_mutex_t work_lock;
+	size_t jobs;
+	struct arena arena;	/* page metadata, only used by the main thread */
+	struct pool page_pool;
+	struct page **pages;	/* in step with work */
+	struct owner *owners;
+	size_t owner_count;
+	size_t owner_bufsize;
+	struct page **sorted;	/* the newest pages, see select_newest() */
+	size_t sorted_count;
+	size_t news_count;
+	size_t feed_count;
+	struct archive_shard *shards;
+	size_t shard_count;
 	size_t page_count;
+	bool archived;
+	bool syndicated;
+	bool make_news;
+	bool news_is_home;
+	bool watch;
 	bool hide_user;
+	bool search;
+	size_t search_shards;
+	bool coproc_mode;
+	bool markdown;
+	bool use_plugin;
+	bool in_process;	/* -m or a plugin, rendering into the worker */
+	bool identity;
+	bool stats;
+	bool stats_json;
+	bool failed;
 } x = {0};
 
 
@@ -61,34 +171,73 @@ free_page(struct page *p)
 {
 	if (p == NULL) return;
 
-	free(p->title);
-	free(p->body);
-	free(p->user);
-	free(p->created_iso);
-	free(p->created_readable);
-	free(p->modified_iso);
-	free(p->modified_readable);
-	free(p->htpath);
+	/* everything else is in x.arena */
+	unmap_file(p->body, p->body_map);
+	p->body = NULL;
+	search_terms_free(&p->terms);
 }
 
-static struct page *
-create_page(const char *path, const struct stat *s)
+/* Paths under src, such as the watcher's, relative to it */
+static const char *
+src_relative(const char *path)
+{
+	return path + sizeof("./src/") - 1;
+}
+
+static int
+format_date(time_t t, struct date_str *d)
 {
-	int datefd = -1;
-	char *datepath = NULL;
-	int ret = 0;
-	time_t tsecs;
 	struct tm tm;
-	char *parser_args[3] = {NULL};
-	char timestr[32];
-	struct passwd *pw;
-	struct page page = {0};
+
+	if (gmtime_r(&t, &tm) == NULL) {
+		perror("gmtime_r");
+		return -1;
+	}
+	strftime(d->iso, sizeof(d->iso), "%FT%H:%M:%SZ", &tm);
+	strftime(d->readable, sizeof(d->readable), "%F %H:%M UTC", &tm);
+	return 0;
+}
+
+static const char *
+owner_name(uid_t uid)
+{
+	struct passwd pwd;
+	struct passwd *pw = NULL;
+	char pwbuf[1024];
+	struct owner *o;
+
+	for (size_t i = 0; i < x.owner_count; ++i) {
+		if (x.owners[i].uid == uid) {
+			return x.owners[i].name;
+		}
+	}
+
+	if (x.owner_count >= x.owner_bufsize) {
+		x.owner_bufsize = x.owner_bufsize == 0 ? 4 : x.owner_bufsize * 2;
+		x.owners = xreallocarray(x.owners, x.owner_bufsize,
+		    sizeof(struct owner));
+	}
+	getpwuid_r(uid, &pwd, pwbuf, sizeof(pwbuf), &pw);
+	o = &x.owners[x.owner_count++];
+	o->uid = uid;
+	o->name = arena_strdup(&x.arena, pw != NULL ? pw->pw_name : "NULL");
+	return o->name;
+}
+
+static void
+create_page(const struct work *w, struct page *page)
+{
+	const char *path = w->rel;
+	time_t tsecs;
+	uint64_t start;
+	char *path_no_ext;
+	size_t len;
 
 	if (strcmp(path, "index") == 0 ||
 	    strncmp(path, "index.", sizeof("index.") - 1) == 0) {
 		/* We are looking at the root index. */
 
-		page.title = xstrdup("Home");
+		page->title = arena_strdup(&x.arena, "Home");
 	} else {
 		const char *p;
 		char *t;
@@ -106,20 +255,20 @@ create_page(const char *path, const struct stat *s)
 		if (strcmp(p, "index") == 0 ||
 		    strncmp(p, "index.", sizeof("index.") - 1) == 0) {
 			for (--p; p >= path && *(p - 1) != '/'; --p);
-			page.title = xstrdup(p);
-			for (t = page.title; *t != '\0'; ++t) {
+			page->title = arena_strdup(&x.arena, p);
+			for (t = page->title; *t != '\0'; ++t) {
 				if (*t == '/') {
 					*t = '\0';
 					break;
 				}
 			}
 		} else {
-			page.title = xstrdup(p);
+			page->title = arena_strdup(&x.arena, p);
 
 			/* Strip the file extension and add whitespace */
 
-			for (t = page.title; *t != '\0'; ++t);
-			for (; t >= page.title; --t) {
+			for (t = page->title; *t != '\0'; ++t);
+			for (; t >= page->title; --t) {
 				if (*t == '.') {
 					*t = '\0';
 					break;
@@ -127,601 +276,1718 @@ create_page(const char *path, const struct stat *s)
 			}
 		}
 
-		for (t = page.title; *t != '\0'; ++t) {
+		for (t = page->title; *t != '\0'; ++t) {
 			if (*t == '_' || *t == '-') *t = ' ';
 		}
 	}
 
-	/* we use .date files to track "creation" dates */
-
-	xasprintf(&datepath, "%s.date", path - sizeof("./src/") + 1);
+	/*
+	 * Creation dates are kept in the date index. Older versions kept
+	 * them as the mtime of .date files, those are imported when found.
+	 */
 
-	if ((datefd = open(datepath, O_RDONLY)) == -1) {
-		tsecs = time(NULL);
-		if ((datefd = open(datepath,
-		    O_WRONLY | O_CREAT | O_TRUNC,
-		    S_IRUSR | S_IRGRP | S_IROTH)) == -1) {
-			perror("open");
-			goto error;
-		}
-	} else {
+	start = stats_now();
+	if (!dates_lookup(&x.dates, path, &tsecs)) {
+		char *datepath = NULL;
 		struct stat datestat;
 
-		if (fstat(datefd, &datestat) == -1) {
-			perror("fstat");
-			goto error;
+		xasprintf(&datepath, "%s.date", w->path);
+		if (stat(datepath, &datestat) == 0) {
+			tsecs = datestat.st_mtim.tv_sec;
+		} else {
+			tsecs = time(NULL);
 		}
-		memcpy(&tsecs, &datestat.st_mtim, sizeof(time_t));
-	}
-
-	if (gmtime_r(&tsecs, &tm) == NULL) {
-		perror("gmtime_r");
-		goto error;
+		free(datepath);
+		dates_add(&x.dates, path, tsecs);
 	}
+	stats_time(STATS_DATES, start);
 
-	page.created = tsecs;
-	strftime(timestr, sizeof(timestr), "%FT%H:%M:%SZ", &tm);
-	page.created_iso = xstrdup(timestr);
-	strftime(timestr, sizeof(timestr), "%F %H:%M UTC", &tm);
-	page.created_readable = xstrdup(timestr);
-
-	if (gmtime_r((time_t *)&s->st_mtim, &tm) == NULL) {
-		perror("gmtime_r");
-		goto error;
-	}
+	page->created = tsecs;
+	page->modified = w->st.st_mtim.tv_sec;
+	page->user = owner_name(w->st.st_uid);
 
-	memcpy(&page.modified, &s->st_mtim, sizeof(time_t));
-	strftime(timestr, sizeof(timestr), "%FT%H:%M:%SZ", &tm);
-	page.modified_iso = xstrdup(timestr);
-	strftime(timestr, sizeof(timestr), "%F %H:%M UTC", &tm);
-	page.modified_readable = xstrdup(timestr);
+	path_no_ext = strip_extension(xstrdup(path));
+	len = strlen(path_no_ext) + sizeof("/.html");
+	page->htpath = arena_alloc(&x.arena, len);
+	snprintf(page->htpath, len, "/%s.html", path_no_ext);
+	free(path_no_ext);
+}
 
-	pw = getpwuid(s->st_uid);
-	page.user = xstrdup(pw != NULL ? pw->pw_name : "NULL");
+/*
+ * With -m or a plugin, a page which is only going into its own output
+ * (see mark_streamed()) is rendered into the worker's buffer, and is
+ * borrowed from there until render_page() is done with it.
+ */
+static int
+parse_page(const struct work *w, struct worker *wk, struct page *page)
+{
+	char *parser_args[3] = {NULL};
+	uint64_t start = stats_now();
 
-	parser_args[0] = xstrdup(x.parser);
-	parser_args[1] = xstrdup(path - sizeof("./src/") + 1);
+	if (x.identity) {
+		page->body = map_file(w->path, &page->body_len,
+		    &page->body_map);
+	} else if (x.coproc_mode) {
+		char *src;
+		size_t src_len;
 
-	if ((page.body = read_pipe(parser_args, &page.body_len)) == NULL) {
-		goto error;
-	}
+		if ((src = read_file(w->path, &src_len)) == NULL) {
+			return -1;
+		}
+		stats_add(STATS_READ, src_len);
+		page->body = coproc_render(wk->cp, src, src_len,
+		    &page->body_len);
+		free(src);
+	} else if (x.in_process) {
+		char *src;
+		size_t src_len;
+		size_t src_map;
+
+		if ((src = map_file(w->path, &src_len, &src_map)) == NULL) {
+			return -1;
+		}
+		stats_add(STATS_READ, src_len);
+		wk->out.len = 0;
+		if (x.markdown) {
+			markdown_render(&wk->md, src, src_len, &wk->out);
+		} else if (plugin_render(&x.plugin, src, src_len, w->path,
+		    &wk->out) == -1) {
+			unmap_file(src, src_map);
+			return -1;
+		}
+		unmap_file(src, src_map);
 
-	if (x.page_bufsize == 0) {
-		x.page_bufsize = 16;
-		x.pages = xreallocarray(NULL,
-		    x.page_bufsize, sizeof(struct page));
-	} else if (x.page_count >= x.page_bufsize) {
-		x.page_bufsize = x.page_bufsize * 2;
-		x.pages = xreallocarray(x.pages,
-		    x.page_bufsize, sizeof(struct page));
+		if (page->stream) {
+			page->body = wk->out.data;
+			page->body_len = wk->out.len;
+		} else {
+			page->body = buf_detach(&wk->out, &page->body_len);
+		}
+	} else {
+		parser_args[0] = (char *)x.parser;
+		parser_args[1] = w->path;
+		page->body = read_pipe(parser_args, &page->body_len);
+		stats_add(STATS_PROCESSES, 1);
 	}
+	if (page->body == NULL) return -1;
 
-	memcpy(x.pages + x.page_count, &page, sizeof(struct page));
-
-end:
-	if (datepath != NULL) {
-		free(datepath);
+	if (!x.in_process) {
+		stats_add(STATS_READ, page->body_len);
 	}
-	if (datefd != -1) {
-		close(datefd);
+	stats_time(STATS_PARSE, start);
+	if (!x.identity) {
+		stats_parser(stats_now() - start);
 	}
-	free(parser_args[0]);
-	free(parser_args[1]);
-	return ret == 0 ? &x.pages[x.page_count++] : NULL;
-error:
-	ret = -1;
-	goto end;
+	return 0;
 }
 
+/*
+ * Check the page against the manifest from the last build, to see if it
+ * can be skipped. Its hash is also worked out here for the new manifest.
+ */
 static int
-traverse(const char *path, const struct stat *s, int flag)
+check_page(const struct work *w, struct page *page)
 {
-	int ret = 0;
-	char *path_no_ext = NULL;
-	FILE *out = NULL;
+	const struct manifest_entry *e;
+	char *src;
 	char *out_path = NULL;
-	char *header = NULL;
-	size_t header_len;
-	char *footer = NULL;
-	size_t footer_len;
-	char *sed_args[16] = {NULL};
-	struct page *page = NULL;
-	const char *date_ext = path;
-
-	while ((date_ext = strstr(date_ext, ".date")) != NULL) {
-		if (*(date_ext + sizeof(".date") - 1) == '\0') {
-			return 0;
-		}
-	}
+	size_t src_len;
+	size_t src_map;
+	struct stat out;
 
-	/* Strip the first part of the path to get the HTTP path */
+	e = manifest_find(&x.manifest, w->path);
 
-	path += sizeof("./src") - 1;
-	if (path[0] == '\0') return 0;
-	++path;
-
-	if (S_ISDIR(s->st_mode)) {
-		puts(path);
-
-		xasprintf(&out_path, "./build/%s", path);
-
-		if (mkdir(out_path, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) == -1) {
-			if (errno != EEXIST) {
-				perror("mkdir");
-				goto error;
-			}
-		}
+	if (e != NULL && e->size == w->st.st_size &&
+	    e->mtime == w->st.st_mtim.tv_sec &&
+	    e->mtime_nsec == w->st.st_mtim.tv_nsec) {
+		page->hash = e->hash;
 	} else {
-		time_t secs = time(NULL);
-		struct tm now;
-
-		if (gmtime_r(&secs, &now) == NULL) {
-			perror("gmtime_r");
-			goto error;
-		}
-
-		if ((page = create_page(path, s)) == NULL) {
-			goto error;
+		if ((src = map_file(w->path, &src_len, &src_map)) == NULL) {
+			return -1;
 		}
+		page->hash = hash64(src, src_len, 0);
+		stats_add(STATS_READ, src_len);
+		unmap_file(src, src_map);
+	}
 
-		path_no_ext = strip_extension(xstrdup(path));
-		xasprintf(&out_path, "./build/%s.html", path_no_ext);
-
-		page->htpath = xstrdup(out_path + sizeof("./build") - 1);
+	/* the modification time is part of the output, so it has to match */
+	if (e == NULL || x.manifest.inputs != x.inputs ||
+	    e->hash != page->hash || e->mtime != w->st.st_mtim.tv_sec ||
+	    e->uid != w->st.st_uid || e->created != page->created) {
+		return 0;
+	}
 
-		printf("%s -> %s (%s)\n", path, page->title, out_path);
+	/* make sure nobody has removed or changed the output either */
+	xasprintf(&out_path, "./build%s", page->htpath);
+	if (stat(out_path, &out) == 0 && out.st_size == e->out_size &&
+	    (size_t)e->out_size >= e->body_off + e->body_len) {
+		page->clean = true;
+		page->out_size = e->out_size;
+		page->body_off = e->body_off;
+		page->body_len = e->body_len;
+	}
+	free(out_path);
+	return 0;
+}
 
-		/* Make header */
+/*
+ * Parser output is cached by the source it came from, where that is, and
+ * the parser: a parser is given the path, and may well use it.
+ */
+static uint64_t
+cache_key(const struct work *w, const struct page *page)
+{
+	return hash_str(x.parser, hash_str(x.coproc_mode ? "-P" : "-p",
+	    hash_str(w->rel, page->hash)));
+}
 
-		sed_args[0] = xstrdup("sed");
+static const char *
+find_tag(const char *s, const char *end, const char *tag)
+{
+	size_t len = strlen(tag);
 
-		xasprintf(&sed_args[1], "-e s|${base_url}|%s|g",
-		    x.base_url);
-		xasprintf(&sed_args[2], "-e s|${year}|%d|g",
-		    now.tm_year + 1900);
-		xasprintf(&sed_args[3], "-e s|${created}|%s|g",
-		    page->created_iso);
-		xasprintf(&sed_args[4], "-e s|${created_readable}|%s|g",
-		    page->created_readable);
-		xasprintf(&sed_args[5], "-e s|${modified}|%s|g",
-		    page->modified_iso);
-		xasprintf(&sed_args[6], "-e s|${modified_readable}|%s|g",
-		    page->modified_readable);
-		xasprintf(&sed_args[7], "-e s|${owner}|%s|g", page->user);
-		xasprintf(&sed_args[8], "-e s|${title}|%s|g", page->title);
+	while ((s = memchr(s, '<', (size_t)(end - s))) != NULL) {
+		if ((size_t)(end - s) < len) return NULL;
+		if (memcmp(s, tag, len) == 0) return s;
+		++s;
+	}
+	return NULL;
+}
 
-		sed_args[9] = xstrdup("header.html");
+/*
+ * Work out the part of the body shown as an excerpt: from past a leading
+ * heading to the end of the first paragraph, and whether there is more
+ * after it. This is done once, when the body comes in, moving forward
+ * through it only as far as it needs to.
+ */
+static void
+find_excerpt(struct page *p)
+{
+	const char *end = p->body + p->body_len;
+	const char *s = p->body;
+	const char *t;
+
+	/* don't include the initial header tag */
+	if (p->body_len >= 2 && memcmp(s, "<h", 2) == 0 &&
+	    (t = find_tag(s + 2, end, "</h")) != NULL) {
+		s = end - t > 5 ? t + 5 : end;
+	}
 
-		if ((header = read_pipe(sed_args, &header_len)) == NULL) {
-			goto error;
-		}
+	p->excerpt_off = (size_t)(s - p->body);
+	p->excerpt_end = p->body_len;
+	p->excerpt_more = false;
+	if ((t = find_tag(s, end, "</p>")) != NULL) {
+		p->excerpt_end = (size_t)(t + 4 - p->body);
+		p->excerpt_more = find_tag(t + 4, end, "<p>") != NULL;
+	}
+}
 
-		free(sed_args[9]);
-		sed_args[9] = xstrdup("footer.html");
-		if ((footer = read_pipe(sed_args, &footer_len)) == NULL) {
-			goto error;
-		}
+/* The bodies of pages skipped by an incremental build are read back lazily */
+static int
+load_body(struct page *p)
+{
+	int fd;
+	char *out_path = NULL;
+	ssize_t ret;
 
-		out = fopen(out_path, "w");
-		if (out == NULL) {
-			perror("fopen");
-			goto error;
-		}
-		if (fwrite(header, 1, header_len, out) < header_len) {
-			perror("fwrite");
-			goto error;
-		}
-		if (fwrite(page->body, 1, page->body_len, out) < page->body_len) {
-			perror("fwrite");
-			goto error;
-		}
-		if (fwrite(footer, 1, footer_len, out) < footer_len) {
-			perror("fwrite");
-			goto error;
-		}
-	}
+	if (p->body != NULL) return 0;
 
-end:
-	if (out != NULL) {
-		fclose(out);
+	xasprintf(&out_path, "./build%s", p->htpath);
+	if ((fd = open(out_path, O_RDONLY)) == -1) {
+		perror(out_path);
+		free(out_path);
+		return -1;
 	}
 	free(out_path);
-	free(header);
-	free(footer);
-	free(path_no_ext);
-	for (size_t i = 0; i < (sizeof(sed_args) / sizeof(char *)); ++i) {
-		free(sed_args[i]);
+
+	p->body = xmalloc(p->body_len + 1);
+	ret = pread(fd, p->body, p->body_len, (off_t)p->body_off);
+	close(fd);
+	if (ret != (ssize_t)p->body_len) {
+		fprintf(stderr, "%s: failed to read back %s\n",
+		    x.program, p->htpath);
+		free(p->body);
+		p->body = NULL;
+		return -1;
 	}
-	return ret;
-error:
-	ret = -1;
-	goto end;
+	p->body[p->body_len] = '\0';
+	stats_add(STATS_READ, p->body_len);
+	find_excerpt(p);
+	return 0;
 }
 
+/*
+ * Make the directories of src in build, and take its pages from tree as
+ * the work for build_pages(), in order.
+ */
 static int
-create_archive(void)
+collect_pages(struct walk *tree)
 {
-	int ret = 0;
-	char *sed_args[16] = {NULL};
-	FILE *out = NULL;
-	char *header = NULL;
-	size_t header_len;
-	char *footer = NULL;
-	size_t footer_len;
-	time_t secs = time(NULL);
-	char timestr[32];
-	struct tm now;
+	char *out_path = NULL;
+	size_t len;
 
-	if (gmtime_r(&secs, &now) == NULL) {
-		perror("gmtime_r");
-		goto error;
+	for (size_t i = 0; i < tree->dir_count; ++i) {
+		puts(tree->dirs[i]);
+
+		xasprintf(&out_path, "./build/%s", tree->dirs[i]);
+		if (mkdir(out_path, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) == -1 &&
+		    errno != EEXIST) {
+			perror("mkdir");
+			free(out_path);
+			return -1;
+		}
+		free(out_path);
 	}
 
-	sed_args[0] = xstrdup("sed");
+	x.work_bufsize = tree->count > 16 ? tree->count : 16;
+	x.work = xreallocarray(x.work, x.work_bufsize, sizeof(struct work));
+	for (size_t i = 0; i < tree->count; ++i) {
+		struct walk_file *f = &tree->files[i];
+		struct work *w;
+
+		/* skip .date files left over from older versions */
+		len = strlen(f->path);
+		if (len >= sizeof(".date") - 1 &&
+		    strcmp(f->path + len - (sizeof(".date") - 1),
+		    ".date") == 0) {
+			continue;
+		}
 
-	xasprintf(&sed_args[1], "-e s|${base_url}|%s|g", x.base_url);
-	xasprintf(&sed_args[2], "-e s|${year}|%d|g", now.tm_year + 1900);
-	strftime(timestr, sizeof(timestr), "%FT%H:%M:%SZ", &now);
-	xasprintf(&sed_args[3], "-e s|${created}|%s|g", timestr);
-	xasprintf(&sed_args[4], "-e s|${modified}|%s|g", timestr);
-	strftime(timestr, sizeof(timestr), "%F %H:%M UTC", &now);
-	xasprintf(&sed_args[5], "-e s|${created_readable}|%s|g", timestr);
-	xasprintf(&sed_args[6], "-e s|${modified_readable}|%s|g", timestr);
-	xasprintf(&sed_args[7], "-e s|${owner}|%s|g", getlogin());
-	xasprintf(&sed_args[8], "-e s|${title}|%s|g", "Archive");
+		w = &x.work[x.work_count++];
+		w->path = f->path;
+		w->rel = f->rel;
+		w->st = f->st;
+		f->path = NULL;
+	}
+	walk_free(tree);
+	return 0;
+}
 
-	sed_args[9] = xstrdup("header.html");
+/*
+ * Run the parser with its output going straight into the output file, for
+ * pages whose body isn't needed by the news or feed. load_body() can still
+ * read it back if it turns out to be.
+ */
+static int
+stream_page(const struct work *w, struct page *page, const char *out_path,
+    const char *header, size_t header_len,
+    const char *footer, size_t footer_len)
+{
+	struct output_file out;
+	char *parser_args[3] = {NULL};
+	char *data;
+	size_t len;
+	size_t map_len;
+	uint64_t start;
+	uint64_t parse_start;
 
-	if ((header = read_pipe(sed_args, &header_len)) == NULL) {
-		goto error;
-	}
+	parser_args[0] = (char *)x.parser;
+	parser_args[1] = w->path;
 
-	free(sed_args[9]);
-	sed_args[9] = xstrdup("footer.html");
-	if ((footer = read_pipe(sed_args, &footer_len)) == NULL) {
-		goto error;
+	start = stats_now();
+	if (output_open(&out, out_path) == -1) {
+		return -1;
 	}
-
-	out = fopen("./build/archive.html", "w");
-	if (out == NULL) {
-		perror("fopen");
-		goto error;
+	if (write_fully(out.fd, header, header_len) == -1) {
+		output_discard(&out);
+		return -1;
 	}
 
-	if (fwrite(header, 1, header_len, out) < header_len) {
-		perror("fwrite");
-		goto error;
+	/* the parser writes straight into the output */
+	parse_start = stats_now();
+	if (spawn_stream(parser_args, out.fd, &page->body_len) == -1) {
+		output_discard(&out);
+		return -1;
 	}
-
-	if (fputs("<h1>Archive</h1>\n", out) < 0) goto efputs;
-	if (fputs("<table class=\"sortable archive\">\n", out) < 0) {
-		goto efputs;
+	stats_add(STATS_PROCESSES, 1);
+	stats_add(STATS_READ, page->body_len);
+	stats_time(STATS_PARSE, parse_start);
+	stats_parser(stats_now() - parse_start);
+	start += stats_now() - parse_start;
+
+	if (write_fully(out.fd, footer, footer_len) == -1) {
+		output_discard(&out);
+		return -1;
 	}
-	if (fputs("<thead>\n", out) < 0) goto efputs;
-	if (fputs("<tr>\n", out) < 0) goto efputs;
-	if (fputs("<th>Title</th>\n", out) < 0) goto efputs;
-	if (fputs("<th>Date created</th>\n", out) < 0) goto efputs;
-	if (fputs("<th>Date modified</th>\n", out) < 0) goto efputs;
-	if (!x.hide_user) {
-		if (fputs("<th>Author</th>\n", out) < 0) goto efputs;
+	if (output_close(&out) == -1) {
+		return -1;
 	}
-	if (fputs("</tr>\n", out) < 0) goto efputs;
-	if (fputs("</thead>\n", out) < 0) goto efputs;
-	if (fputs("<tbody>\n", out) < 0) goto efputs;
+	stats_time(STATS_WRITE, start);
 
-	for (size_t i = 0; i < x.page_count; ++i) {
-		struct page *p = &x.pages[i];
-
-		if (fputs("<tr>\n", out) < 0) goto efputs;
-		if (fprintf(out, "<td><a href=\"%s%s\">%s</a></td>\n",
-		    x.base_url, p->htpath, p->title) < 0) {
-			goto efprintf;
-		}
-		if (fprintf(out, "<td><date datetime=\"%s\">%s</date></td>\n",
-		    p->created_iso, p->created_readable) < 0) {
-			goto efprintf;
-		}
-		if (fprintf(out, "<td><date datetime=\"%s\">%s</date></td>\n",
-		    p->modified_iso, p->modified_readable) < 0) {
-			goto efprintf;
+	if (x.use_cache &&
+	    (data = map_file(out_path, &len, &map_len)) != NULL) {
+		if (len >= header_len + page->body_len) {
+			cache_put("./build/.cache", cache_key(w, page),
+			    data + header_len, page->body_len);
 		}
-		if (!x.hide_user &&
-		    fprintf(out, "<td>%s</td>\n", p->user) < 0) {
-			goto efprintf;
-		}
-		if (fputs("</tr>\n", out) < 0) goto efputs;
+		unmap_file(data, map_len);
 	}
+	return 0;
+}
 
-	if (fputs("</tbody>\n", out) < 0) goto efputs;
-	if (fputs("</table>\n", out) < 0) goto efputs;
-	if (fputs("<p>This table should be sortable (by selecting the headers)"
-	    " with a JavaScript-capable user agent.</p> \n", out) < 0) {
-		goto efputs;
-	}
+/*
+ * The title and owner are text rather than markup, so they are escaped
+ * into esc, one after the other, before going into the templates.
+ */
+static void
+escape_vars(const char *vars[TV_COUNT], const char *title, const char *owner,
+    struct buf *esc)
+{
+	size_t owner_off;
+
+	escape_appends(esc, title);
+	buf_append(esc, "", 1);
+	owner_off = esc->len;
+	escape_appends(esc, owner);
+	vars[TV_TITLE] = esc->data;
+	vars[TV_OWNER] = esc->data + owner_off;
+}
 
-	if (fwrite(footer, 1, footer_len, out) < footer_len) {
-		perror("fwrite");
-		goto error;
-	}
+/* A page's stored terms are good for as long as it would be left alone */
+static uint64_t
+search_key(const struct page *page)
+{
+	return hash64(&page->hash, sizeof(page->hash), x.inputs);
+}
 
-end:
-	if (out != NULL) {
-		fclose(out);
+/*
+ * Break the page into terms for the search index, in the worker's thread.
+ * A page which didn't need rebuilding keeps its terms from the last build,
+ * or failing that is read back from its output.
+ */
+static int
+index_page(struct worker *wk, struct page *page)
+{
+	bool loaded = page->body == NULL;
+	uint64_t start = stats_now();
+
+	if (!x.search || page->terms.data != NULL) return 0;
+
+	if (page->clean && search_store_find(&x.search_store, page->htpath,
+	    search_key(page), &page->terms)) {
+		stats_time(STATS_TOKENIZE, start);
+		return 0;
 	}
-	for (size_t i = 0; i < (sizeof(sed_args) / sizeof(char *)); ++i) {
-		free(sed_args[i]);
+	if (loaded && load_body(page) == -1) return -1;
+	search_tokenize(&wk->search, page->title, page->body, page->body_len,
+	    &page->terms);
+	if (loaded) {
+		free(page->body);
+		page->body = NULL;
 	}
-	return ret;
-efprintf:
-	perror("fprintf");
-	goto error;
-efputs:
-	perror("fputs");
-	goto error;
-error:
-	ret = -1;
-	goto end;
+	stats_time(STATS_TOKENIZE, start);
+	return 0;
 }
 
 static int
-create_news(const char *filename)
+render_page(const struct work *w, struct worker *wk, struct page *page)
 {
 	int ret = 0;
-	char *sed_args[16] = {NULL};
-	FILE *out = NULL;
-	char *header = NULL;
+	bool borrowed = x.in_process && page->stream && page->body == NULL;
+	bool stream = page->stream && !x.in_process;
+	const char *path = w->rel;
+	char *out_path = NULL;
+	struct buf tpl = {0};
+	struct buf esc = {0};
+	const char *header;
 	size_t header_len;
-	char *footer = NULL;
+	const char *footer;
 	size_t footer_len;
+	const char *vars[TV_COUNT];
+	char year[16];
+	struct date_str created;
+	struct date_str modified;
+	struct iovec iov[3];
 	time_t secs = time(NULL);
-	char timestr[32];
 	struct tm now;
-	size_t count = x.page_count < 10 ? x.page_count : 10;
+	uint64_t page_start = stats_now();
+	uint64_t start;
 
 	if (gmtime_r(&secs, &now) == NULL) {
 		perror("gmtime_r");
 		goto error;
 	}
 
-	sed_args[0] = xstrdup("sed");
-
-	xasprintf(&sed_args[1], "-e s|${base_url}|%s|g", x.base_url);
-	xasprintf(&sed_args[2], "-e s|${year}|%d|g", now.tm_year + 1900);
-	strftime(timestr, sizeof(timestr), "%FT%H:%M:%SZ", &now);
-	xasprintf(&sed_args[3], "-e s|${created}|%s|g", timestr);
-	xasprintf(&sed_args[4], "-e s|${modified}|%s|g", timestr);
-	strftime(timestr, sizeof(timestr), "%F %H:%M UTC", &now);
-	xasprintf(&sed_args[5], "-e s|${created_readable}|%s|g", timestr);
-	xasprintf(&sed_args[6], "-e s|${modified_readable}|%s|g", timestr);
-	xasprintf(&sed_args[7], "-e s|${owner}|%s|g", getlogin());
-	xasprintf(&sed_args[8], "-e s|${title}|%s|g", "News");
-
-	sed_args[9] = xstrdup("header.html");
-
-	if ((header = read_pipe(sed_args, &header_len)) == NULL) {
-		goto error;
+	if (page->clean) {
+		return index_page(wk, page);
 	}
 
-	free(sed_args[9]);
-	sed_args[9] = xstrdup("footer.html");
-	if ((footer = read_pipe(sed_args, &footer_len)) == NULL) {
+	if (page->body == NULL && !stream &&
+	    parse_page(w, wk, page) == -1) {
 		goto error;
 	}
-
-	out = fopen(filename, "w");
-	if (out == NULL) {
-		perror("fopen");
-		goto error;
+	if (!stream) {
+		find_excerpt(page);
 	}
-
-	if (fwrite(header, 1, header_len, out) < header_len) {
-		perror("fwrite");
+	if (index_page(wk, page) == -1) {
 		goto error;
 	}
+	if (x.use_cache && !page->cached && !stream) {
+		/* not worth failing the build over */
+		cache_put("./build/.cache", cache_key(w, page), page->body,
+		    page->body_len);
+	}
 
-	for (size_t i = 0; i < count; ++i) {
-		struct page *p = &x.pages[i];
-		bool multi_paragraph = false;
-		char *str = xstrdup(p->body);
-		char *body = str;
-		char *endpara;
-
-		/* don't include the initial header tag in the body */
-		if (strncmp("<h", body, 2) == 0) {
-			char *past_header = strstr(body + 2, "</h");
-
-			if (past_header != NULL) {
-				body = past_header + 5;
-			}
-		}
+	xasprintf(&out_path, "./build%s", page->htpath);
 
-		/* terminate after the end of the first paragraph */
-		if ((endpara = strstr(body, "</p>")) != NULL) {
-			if (strstr(endpara + 4, "<p>") != NULL) {
-				multi_paragraph = true;
-			}
-			*(endpara + 4) = '\0';
-		}
+	printf("%s -> %s (%s)\n", path, page->title, out_path);
 
-		if (fputs("<article class=\"preview\">\n", out) < 0) {
-			free(str);
-			goto efputs;
-		}
-		if (fprintf(out, "<h2><a href=\"%s%s\">%s</a></h2>\n",
-		    x.base_url, p->htpath, p->title) < 0) {
-			free(str);
-			goto efprintf;
+	/* Make header */
+
+	if (format_date(page->created, &created) == -1 ||
+	    format_date(page->modified, &modified) == -1) {
+		goto error;
+	}
+	snprintf(year, sizeof(year), "%d", now.tm_year + 1900);
+	vars[TV_BASE_URL] = x.base_url;
+	vars[TV_YEAR] = year;
+	vars[TV_CREATED] = created.iso;
+	vars[TV_CREATED_READABLE] = created.readable;
+	vars[TV_MODIFIED] = modified.iso;
+	vars[TV_MODIFIED_READABLE] = modified.readable;
+	escape_vars(vars, page->title, page->user, &esc);
+
+	/* both go into the one buffer, the footer after the header */
+	start = stats_now();
+	template_expand(&x.header, vars, &tpl);
+	header_len = tpl.len;
+	template_expand(&x.footer, vars, &tpl);
+	footer_len = tpl.len - header_len;
+	header = tpl.data;
+	footer = tpl.data + header_len;
+	stats_time(STATS_TEMPLATE, start);
+
+	if (stream) {
+		if (stream_page(w, page, out_path, header, header_len,
+		    footer, footer_len) == -1) {
+			goto error;
 		}
-		if (fprintf(out, "<p class=\"byline\">Created "
-		    "<date datetime=\"%s\">%s</date>",
-		    p->created_iso, p->created_readable) < 0) {
-			free(str);
-			goto efprintf;
-		}
-		if (!x.hide_user && fprintf(out, " by %s", p->user) < 0) {
-			free(str);
-			goto efprintf;
-		}
-		if (fputs("</p>\n", out) < 0) {
-			free(str);
-			goto efputs;
-		}
-		if (fputs(body, out) < 0) goto efputs;
-		free(str);
-		if (multi_paragraph) {
-			if (fputs("\n<p class=\"cont\"><em>"
-			    "Continued...</em></p>", out) < 0) {
-				goto efputs;
-			}
+	} else {
+		iov[0].iov_base = (char *)header;
+		iov[0].iov_len = header_len;
+		iov[1].iov_base = page->body;
+		iov[1].iov_len = page->body_len;
+		iov[2].iov_base = (char *)footer;
+		iov[2].iov_len = footer_len;
+		start = stats_now();
+		if (output_writev(out_path, iov, 3) == -1) {
+			goto error;
 		}
-		if (fputs("\n</article>\n", out) < 0) goto efputs;
+		stats_time(STATS_WRITE, start);
 	}
 
-	if (fwrite(footer, 1, footer_len, out) < footer_len) {
-		perror("fwrite");
-		goto error;
+	page->body_off = header_len;
+	page->out_size = (off_t)(header_len + page->body_len + footer_len);
+
+	stats_add(STATS_PAGES, 1);
+	stats_add(STATS_WRITTEN, (uint64_t)page->out_size);
+	stats_page(path, stats_now() - page_start);
+
+	/*
+	 * A mapped body, the source with cat(1) as the parser or a cache
+	 * entry, goes once the page is written: the file under it can be
+	 * cut short at any time, and touching the mapping then is SIGBUS.
+	 * The news and feed read it back from the page with load_body().
+	 */
+	if (page->body_map != 0) {
+		unmap_file(page->body, page->body_map);
+		page->body = NULL;
+		page->body_map = 0;
 	}
 
 end:
-	if (out != NULL) {
-		fclose(out);
-	}
-	for (size_t i = 0; i < (sizeof(sed_args) / sizeof(char *)); ++i) {
-		free(sed_args[i]);
+	if (borrowed) {
+		page->body = NULL;
 	}
+	free(out_path);
+	buf_free(&tpl);
+	buf_free(&esc);
 	return ret;
-efprintf:
-	perror("fprintf");
-	goto error;
-efputs:
-	perror("fputs");
-	goto error;
 error:
 	ret = -1;
 	goto end;
 }
 
-static int
-create_feed(void)
+static void *
+render_worker(void *arg)
 {
-	int ret = 0;
-	FILE *out = NULL;
-	time_t secs = time(NULL);
-	struct tm now;
-	char timestr[32];
-	size_t count = x.page_count < 20 ? x.page_count : 20;
+	struct worker *wk = arg;
+	size_t i;
+
+	for (;;) {
+		pthread_mutex_lock(&x.work_lock);
+		i = x.work_next++;
+		if (x.failed) {
+			i = x.work_count;
+		}
+		pthread_mutex_unlock(&x.work_lock);
 
-	if (gmtime_r(&secs, &now) == NULL) {
-		perror("gmtime_r");
-		goto error;
+		if (i >= x.work_count) break;
+
+		if (render_page(&x.work[i], wk, x.pages[i]) == -1) {
+			pthread_mutex_lock(&x.work_lock);
+			x.failed = true;
+			pthread_mutex_unlock(&x.work_lock);
+			break;
+		}
 	}
+	return NULL;
+}
 
-	strftime(timestr, sizeof(timestr), "%FT%H:%M:%SZ", &now);
+static int
+store_body(struct spawn_job *job)
+{
+	struct page *page = job->data;
 
-	out = fopen("./build/atom.xml", "w");
-	if (out == NULL) {
-		perror("fopen");
-		goto error;
-	}
+	page->body = buf_detach(&job->out, &page->body_len);
+	stats_add(STATS_READ, page->body_len);
+	stats_time(STATS_PARSE, job->started);
+	stats_parser(now_ns() - job->started);
+	return 0;
+}
+
+/*
+ * Run the parser on every collected page, keeping up to x.jobs parsers
+ * going at a time without needing a thread for each.
+ */
+static int
+parse_pages(void)
+{
+	int ret;
+	struct spawn_job *jobs;
+	char **args;
+	size_t count = 0;
+
+	jobs = xreallocarray(NULL, x.work_count, sizeof(struct spawn_job));
+	args = xreallocarray(NULL, x.work_count, 3 * sizeof(char *));
+	memset(jobs, 0, x.work_count * sizeof(struct spawn_job));
+
+	for (size_t i = 0; i < x.work_count; ++i) {
+		if (x.pages[i]->clean || x.pages[i]->body != NULL ||
+		    x.pages[i]->stream) {
+			continue;
+		}
 
-	if (fputs("<?xml version=\"1.0\" encoding=\"utf-8\"?>\n", out) < 0) {
-		goto efputs;
+		args[count * 3] = (char *)x.parser;
+		args[count * 3 + 1] = x.work[i].path;
+		args[count * 3 + 2] = NULL;
+		jobs[count].args = &args[count * 3];
+		jobs[count].data = x.pages[i];
+		++count;
 	}
-	if (fputs("<feed xmlns=\"http://www.w3.org/2005/Atom\">\n", out) < 0) {
-		goto efputs;
+
+	ret = spawn_all(jobs, count, x.jobs, store_body);
+	stats_add(STATS_PROCESSES, count);
+
+	for (size_t i = 0; i < count; ++i) {
+		buf_free(&jobs[i].out);
 	}
-	if (fprintf(out, "<title>%s</title>\n", x.feed_title) < 0) {
-		goto efprintf;
+	free(jobs);
+	free(args);
+	return ret;
+}
+
+static int
+compare_page_dates(const void *v1, const void *v2)
+{
+	const struct page *p1 = *(struct page *const *)v1;
+	const struct page *p2 = *(struct page *const *)v2;
+
+	if (p1->created > p2->created) {
+		return -1;
 	}
-	if (fprintf(out, "<id>%s</id>\n", x.base_url) < 0) {
-		goto efprintf;
+	if (p1->created < p2->created) {
+		return 1;
 	}
-	if (fprintf(out, "<link href=\"%s/\" />\n", x.base_url) < 0) {
-		goto efprintf;
+
+	/*
+	 * Keep pages created at the same time in the order they were found:
+	 * that of their paths, then any added while watching after them.
+	 */
+	if (p1->found != p2->found) {
+		return p1->found < p2->found ? -1 : 1;
 	}
-	if (fprintf(out, "<link rel=\"self\" href=\"%s/atom.xml\" />\n",
-	    x.base_url) < 0) {
-		goto efprintf;
+	return 0;
+}
+
+#define OLDER(a, b)	(compare_page_dates(&(a), &(b)) > 0)
+
+static void
+heap_up(struct page **h, size_t i)
+{
+	struct page *tmp;
+
+	while (i > 0 && OLDER(h[i], h[(i - 1) / 2])) {
+		tmp = h[i];
+		h[i] = h[(i - 1) / 2];
+		h[(i - 1) / 2] = tmp;
+		i = (i - 1) / 2;
 	}
-	if (!x.hide_user) {
-		if (fputs("<author>\n", out) < 0) goto efputs;
-		if (fprintf(out, "\t<name>%s</name>\n", getlogin()) < 0) {
-			goto efprintf;
+}
+
+static void
+heap_down(struct page **h, size_t i, size_t n)
+{
+	struct page *tmp;
+	size_t c;
+
+	while ((c = 2 * i + 1) < n) {
+		if (c + 1 < n && OLDER(h[c + 1], h[c])) {
+			++c;
 		}
-		if (fputs("</author>\n", out) < 0) goto efputs;
+		if (!OLDER(h[c], h[i])) break;
+		tmp = h[i];
+		h[i] = h[c];
+		h[c] = tmp;
+		i = c;
 	}
-	if (fprintf(out, "<updated>%s</updated>\n", timestr) < 0) {
-		goto efprintf;
+}
+
+/*
+ * Put the newest count pages in x.sorted, newest first, without sorting
+ * the rest. While going through the pages, x.sorted is a heap of the
+ * newest seen so far with the oldest of them on top, so this takes
+ * O(n log count) rather than sorting everything.
+ */
+static void
+select_newest(size_t count)
+{
+	size_t n = 0;
+
+	if (count > x.page_count) {
+		count = x.page_count;
+	}
+	x.sorted = xreallocarray(x.sorted, count + 1, sizeof(struct page *));
+
+	for (size_t i = 0; i < x.page_count && count > 0; ++i) {
+		if (n < count) {
+			x.sorted[n] = x.pages[i];
+			heap_up(x.sorted, n++);
+		} else if (OLDER(x.sorted[0], x.pages[i])) {
+			x.sorted[0] = x.pages[i];
+			heap_down(x.sorted, 0, n);
+		}
 	}
 
-	for (size_t i = 0; i < count; ++i) {
-		struct page *p = &x.pages[i];
+	/* take the oldest off the top until they are in order */
+	for (size_t end = n; end > 1; --end) {
+		struct page *tmp = x.sorted[0];
+
+		x.sorted[0] = x.sorted[end - 1];
+		x.sorted[end - 1] = tmp;
+		heap_down(x.sorted, 0, end - 1);
+	}
+	x.sorted_count = n;
+}
+
+/* How many of the newest pages the news and feed need between them */
+static size_t
+newest_needed(void)
+{
+	size_t count = 0;
+
+	if (x.make_news) {
+		count = x.news_count;
+	}
+	if (x.syndicated && count < x.feed_count) {
+		count = x.feed_count;
+	}
+	return count;
+}
+
+/*
+ * Only the newest pages end up in the news and feed, and they can be told
+ * apart by their dates before anything is parsed. The rest don't need
+ * their bodies kept, so they are streamed into place. With -i, a parser's
+ * output is kept to be indexed rather than read back from the page.
+ */
+static void
+mark_streamed(void)
+{
+	select_newest(newest_needed());
+
+	for (size_t i = 0; i < x.page_count; ++i) {
+		struct page *p = x.pages[i];
+
+		p->stream = !p->clean && p->body == NULL &&
+		    (x.in_process || !x.search);
+	}
+	for (size_t i = 0; i < x.sorted_count; ++i) {
+		x.sorted[i]->stream = false;
+	}
+}
+
+/*
+ * Render every collected page, with up to x.jobs at a time. Each page has
+ * a fixed slot in x.pages, so the result is in the same order however
+ * the work ends up being scheduled.
+ */
+static int
+build_pages(void)
+{
+	pthread_t *threads;
+	size_t started = 0;
+	int err;
+
+	x.pages = xreallocarray(NULL, x.work_count, sizeof(struct page *));
+	x.page_count = x.work_count;
+
+	for (size_t i = 0; i < x.work_count; ++i) {
+		const struct work *w = &x.work[i];
+
+		x.pages[i] = pool_get(&x.page_pool);
+		x.pages[i]->found = x.found++;
+		create_page(w, x.pages[i]);
+		if (check_page(w, x.pages[i]) == -1) {
+			return -1;
+		}
+	}
+
+	for (size_t i = 0; x.use_cache && i < x.work_count; ++i) {
+		struct page *p = x.pages[i];
+
+		if (p->clean) continue;
+
+		p->body = cache_get("./build/.cache",
+		    cache_key(&x.work[i], p), &p->body_len, &p->body_map);
+		p->cached = p->body != NULL;
+		if (p->cached) {
+			stats_add(STATS_READ, p->body_len);
+		}
+	}
+
+	if (!x.coproc_mode && !x.identity) {
+		mark_streamed();
+		if (!x.in_process && parse_pages() == -1) return -1;
+	}
+
+	if (x.jobs == 1) {
+		render_worker(&x.workers[0]);
+		return x.failed ? -1 : 0;
+	}
+
+	threads = xreallocarray(NULL, x.jobs, sizeof(pthread_t));
+	for (; started < x.jobs; ++started) {
+		if ((err = pthread_create(&threads[started], NULL,
+		    render_worker, &x.workers[started])) != 0) {
+			fprintf(stderr, "pthread_create: %s\n", strerror(err));
+			pthread_mutex_lock(&x.work_lock);
+			x.failed = true;
+			pthread_mutex_unlock(&x.work_lock);
+			break;
+		}
+	}
+	for (size_t i = 0; i < started; ++i) {
+		pthread_join(threads[i], NULL);
+	}
+	free(threads);
+	return x.failed ? -1 : 0;
+}
+
+static int
+save_manifest(void)
+{
+	FILE *fp;
+
+	if ((fp = manifest_create("./build/.manifest", x.inputs)) == NULL) {
+		return -1;
+	}
+	for (size_t i = 0; i < x.page_count; ++i) {
+		const struct work *w = &x.work[i];
+		const struct page *p = x.pages[i];
+		struct manifest_entry e;
+
+		e.path = w->path;
+		e.mtime = w->st.st_mtim.tv_sec;
+		e.mtime_nsec = w->st.st_mtim.tv_nsec;
+		e.size = w->st.st_size;
+		e.uid = w->st.st_uid;
+		e.created = p->created;
+		e.hash = p->hash;
+		e.out_size = p->out_size;
+		e.body_off = p->body_off;
+		e.body_len = p->body_len;
+
+		if (manifest_add(fp, &e) == -1) {
+			fclose(fp);
+			return -1;
+		}
+	}
+	return manifest_commit(fp, "./build/.manifest");
+}
+
+/*
+ * Hash everything which ends up in every page, so that when any of it
+ * changes the whole site is rebuilt.
+ */
+static uint64_t
+hash_inputs(void)
+{
+	uint64_t h = 0;
+	time_t secs = time(NULL);
+	struct tm now;
+	char year[16];
+
+	gmtime_r(&secs, &now);
+	snprintf(year, sizeof(year), "%d", now.tm_year + 1900);
+
+	h = hash_str(x.header.text, h);
+	h = hash_str(x.footer.text, h);
+	h = hash_str(x.base_url, h);
+	h = hash_str(x.parser, h);
+	h = hash_str(x.markdown ? "-m" : x.coproc_mode ? "-P" : "-p", h);
+	h = hash_str(x.hide_user ? "-u" : "", h);
+	h = hash_str(year, h);
+	return h;
+}
 
-		if (fputs("\n<entry>\n", out) < 0) goto efputs;
-		if (fprintf(out, "<title>%s</title>\n", p->title) < 0) {
-			goto efprintf;
+/*
+ * The pages listing other pages take their dates from the newest of the
+ * first count pages they list rather than from the time of the build, so
+ * that they are only rewritten when something they list has changed.
+ */
+static int
+format_newest(struct page **pages, size_t count, struct date_str *created_str,
+    struct date_str *modified_str)
+{
+	time_t created = 0;
+	time_t modified = 0;
+
+	if (count == 0) {
+		created = modified = time(NULL);
+	}
+	for (size_t i = 0; i < count; ++i) {
+		if (pages[i]->created > created) {
+			created = pages[i]->created;
 		}
-		if (fprintf(out, "<link href=\"%s%s\" />\n",
-		    x.base_url, p->htpath) < 0) {
-			goto efprintf;
+		if (pages[i]->modified > modified) {
+			modified = pages[i]->modified;
 		}
-		if (fprintf(out, "<id>%s%s</id>\n",
-		    x.base_url, p->htpath) < 0) {
-			goto efprintf;
+	}
+
+	if (format_date(created, created_str) == -1 ||
+	    format_date(modified, modified_str) == -1) {
+		return -1;
+	}
+	return 0;
+}
+
+/* Pages are sorted for the archive by a small key rather than in place */
+struct archive_key {
+	time_t created;
+	size_t index;	/* in x.pages */
+	int year;
+};
+
+static int
+compare_archive_keys(const void *v1, const void *v2)
+{
+	const struct archive_key *k1 = v1;
+	const struct archive_key *k2 = v2;
+
+	if (k1->created != k2->created) {
+		return k1->created < k2->created ? -1 : 1;
+	}
+	/* keep pages created at the same time in the order they were found */
+	if (k1->index != k2->index) {
+		return k1->index < k2->index ? -1 : 1;
+	}
+	return 0;
+}
+
+static void
+shard_label(const struct archive_shard *s, char *label, size_t size)
+{
+	if (s->parts > 1) {
+		snprintf(label, size, "%d, part %zu", s->year, s->part);
+	} else {
+		snprintf(label, size, "%d", s->year);
+	}
+}
+
+/* Put body between the header and footer, dated by the pages it lists */
+static int
+write_archive_page(const char *name, const char *title, struct page **pages,
+    size_t count, const struct buf *body)
+{
+	int ret = 0;
+	const char *vars[TV_COUNT];
+	struct buf out;
+	struct buf esc = {0};
+	char *path = NULL;
+	time_t secs = time(NULL);
+	char year[16];
+	struct date_str created;
+	struct date_str modified;
+	struct tm now;
+
+	if (gmtime_r(&secs, &now) == NULL) {
+		perror("gmtime_r");
+		return -1;
+	}
+
+	snprintf(year, sizeof(year), "%d", now.tm_year + 1900);
+	if (format_newest(pages, count, &created, &modified) == -1) {
+		return -1;
+	}
+	vars[TV_BASE_URL] = x.base_url;
+	vars[TV_YEAR] = year;
+	vars[TV_CREATED] = created.iso;
+	vars[TV_CREATED_READABLE] = created.readable;
+	vars[TV_MODIFIED] = modified.iso;
+	vars[TV_MODIFIED_READABLE] = modified.readable;
+	escape_vars(vars, title, getlogin(), &esc);
+
+	buf_init(&out, body->len + 4096);
+	template_expand(&x.header, vars, &out);
+	buf_append(&out, body->data, body->len);
+	template_expand(&x.footer, vars, &out);
+
+	xasprintf(&path, "./build/%s", name);
+	if (output_write(path, out.data, out.len) == -1) {
+		ret = -1;
+	}
+	stats_add(STATS_WRITTEN, out.len);
+	free(path);
+	buf_free(&out);
+	buf_free(&esc);
+	return ret;
+}
+
+static int
+create_archive_shard(struct page **ordered, size_t k)
+{
+	int ret = 0;
+	const struct archive_shard *s = &x.shards[k];
+	struct buf body;
+	char label[64];
+	char title[80];
+
+	shard_label(s, label, sizeof(label));
+	snprintf(title, sizeof(title), "Archive %s", label);
+
+	buf_init(&body, 1024 + (s->end - s->start) * 256);
+	buf_appendf(&body, "<h1>%s</h1>\n"
+	    "<nav class=\"archive\">\n"
+	    "<a href=\"%s/archive.html\">All years</a>\n",
+	    title, x.base_url);
+	if (k > 0) {
+		shard_label(&x.shards[k - 1], label, sizeof(label));
+		buf_appendf(&body, "<a rel=\"prev\" href=\"%s/%s\">%s</a>\n",
+		    x.base_url, x.shards[k - 1].name, label);
+	}
+	if (k + 1 < x.shard_count) {
+		shard_label(&x.shards[k + 1], label, sizeof(label));
+		buf_appendf(&body, "<a rel=\"next\" href=\"%s/%s\">%s</a>\n",
+		    x.base_url, x.shards[k + 1].name, label);
+	}
+	buf_appends(&body, "</nav>\n"
+	    "<table class=\"sortable archive\">\n"
+	    "<thead>\n"
+	    "<tr>\n"
+	    "<th>Title</th>\n"
+	    "<th>Date created</th>\n"
+	    "<th>Date modified</th>\n");
+	if (!x.hide_user) {
+		buf_appends(&body, "<th>Author</th>\n");
+	}
+	buf_appends(&body, "</tr>\n"
+	    "</thead>\n"
+	    "<tbody>\n");
+
+	for (size_t i = s->start; i < s->end; ++i) {
+		struct page *p = ordered[i];
+		struct date_str p_created;
+		struct date_str p_modified;
+
+		if (format_date(p->created, &p_created) == -1 ||
+		    format_date(p->modified, &p_modified) == -1) {
+			goto error;
 		}
+		buf_appendf(&body, "<tr>\n"
+		    "<td><a href=\"%s", x.base_url);
+		escape_appends(&body, p->htpath);
+		buf_appends(&body, "\">");
+		escape_appends(&body, p->title);
+		buf_appendf(&body, "</a></td>\n"
+		    "<td><date datetime=\"%s\">%s</date></td>\n"
+		    "<td><date datetime=\"%s\">%s</date></td>\n",
+		    p_created.iso, p_created.readable,
+		    p_modified.iso, p_modified.readable);
 		if (!x.hide_user) {
-			if (fputs("<author>\n", out) < 0) goto efputs;
-			if (fprintf(out, "\t<name>%s</name>\n", p->user) < 0) {
-				goto efprintf;
+			buf_appends(&body, "<td>");
+			escape_appends(&body, p->user);
+			buf_appends(&body, "</td>\n");
+		}
+		buf_appends(&body, "</tr>\n");
+	}
+
+	buf_appends(&body, "</tbody>\n"
+	    "</table>\n"
+	    "<p>This table should be sortable (by selecting the headers)"
+	    " with a JavaScript-capable user agent.</p> \n");
+
+	if (write_archive_page(s->name, title, ordered + s->start,
+	    s->end - s->start, &body) == -1) {
+		goto error;
+	}
+
+end:
+	buf_free(&body);
+	return ret;
+error:
+	ret = -1;
+	goto end;
+}
+
+/*
+ * The archive is split by the year pages were created in, and years with
+ * many pages into parts, each with its own file. archive.html lists them.
+ * A new page then only changes its own year and the list, and the other
+ * files come out the same and are left alone.
+ */
+static int
+create_archive(void)
+{
+	int ret = 0;
+	struct archive_key *keys;
+	struct page **ordered;
+	struct buf body;
+	char label[64];
+	struct tm tm;
+	size_t start;
+	size_t end;
+
+	keys = xreallocarray(NULL, x.page_count + 1,
+	    sizeof(struct archive_key));
+	ordered = xreallocarray(NULL, x.page_count + 1,
+	    sizeof(struct page *));
+	buf_init(&body, 4096);
+
+	for (size_t i = 0; i < x.page_count; ++i) {
+		keys[i].created = x.pages[i]->created;
+		keys[i].index = i;
+		if (gmtime_r(&keys[i].created, &tm) == NULL) {
+			perror("gmtime_r");
+			goto error;
+		}
+		keys[i].year = tm.tm_year + 1900;
+	}
+	qsort(keys, x.page_count, sizeof(struct archive_key),
+	    compare_archive_keys);
+	for (size_t i = 0; i < x.page_count; ++i) {
+		ordered[i] = x.pages[keys[i].index];
+	}
+
+	x.shard_count = 0;
+	for (start = 0; start < x.page_count; start = end) {
+		int year = keys[start].year;
+		size_t parts;
+
+		for (end = start + 1; end < x.page_count &&
+		    keys[end].year == year; ++end);
+		parts = (end - start + ARCHIVE_ROWS - 1) / ARCHIVE_ROWS;
+
+		x.shards = xreallocarray(x.shards, x.shard_count + parts,
+		    sizeof(struct archive_shard));
+		for (size_t part = 1; part <= parts; ++part) {
+			struct archive_shard *s = &x.shards[x.shard_count++];
+
+			s->year = year;
+			s->part = part;
+			s->parts = parts;
+			s->start = start + (part - 1) * ARCHIVE_ROWS;
+			s->end = part < parts ? s->start + ARCHIVE_ROWS : end;
+			if (part > 1) {
+				snprintf(s->name, sizeof(s->name),
+				    "archive-%d-%zu.html", year, part);
+			} else {
+				snprintf(s->name, sizeof(s->name),
+				    "archive-%d.html", year);
 			}
-			if (fputs("</author>\n", out) < 0) goto efputs;
 		}
-		if (fprintf(out, "<published>%s</published>\n",
-		    p->created_iso) < 0) {
-			goto efprintf;
+	}
+
+	for (size_t k = 0; k < x.shard_count; ++k) {
+		if (create_archive_shard(ordered, k) == -1) goto error;
+	}
+
+	/* newest first */
+	buf_appends(&body, "<h1>Archive</h1>\n"
+	    "<ul class=\"archive\">\n");
+	for (size_t k = x.shard_count; k > 0; --k) {
+		const struct archive_shard *s = &x.shards[k - 1];
+		size_t count = s->end - s->start;
+
+		shard_label(s, label, sizeof(label));
+		buf_appendf(&body, "<li><a href=\"%s/%s\">%s</a> "
+		    "(%zu %s)</li>\n", x.base_url, s->name, label,
+		    count, count == 1 ? "page" : "pages");
+	}
+	buf_appends(&body, "</ul>\n");
+
+	if (write_archive_page("archive.html", "Archive", ordered,
+	    x.page_count, &body) == -1) {
+		goto error;
+	}
+
+end:
+	free(keys);
+	free(ordered);
+	buf_free(&body);
+	return ret;
+error:
+	ret = -1;
+	goto end;
+}
+
+static int
+create_news(const char *filename)
+{
+	int ret = 0;
+	const char *vars[TV_COUNT];
+	struct buf out;
+	struct buf esc = {0};
+	time_t secs = time(NULL);
+	char year[16];
+	struct date_str created;
+	struct date_str modified;
+	struct tm now;
+	size_t count = x.sorted_count < x.news_count ?
+	    x.sorted_count : x.news_count;
+
+	if (gmtime_r(&secs, &now) == NULL) {
+		perror("gmtime_r");
+		return -1;
+	}
+
+	snprintf(year, sizeof(year), "%d", now.tm_year + 1900);
+	if (format_newest(x.sorted, count, &created, &modified) == -1) {
+		return -1;
+	}
+	vars[TV_BASE_URL] = x.base_url;
+	vars[TV_YEAR] = year;
+	vars[TV_CREATED] = created.iso;
+	vars[TV_CREATED_READABLE] = created.readable;
+	vars[TV_MODIFIED] = modified.iso;
+	vars[TV_MODIFIED_READABLE] = modified.readable;
+	escape_vars(vars, "News", getlogin(), &esc);
+
+	buf_init(&out, 4096);
+	template_expand(&x.header, vars, &out);
+
+	for (size_t i = 0; i < count; ++i) {
+		struct page *p = x.sorted[i];
+		struct date_str p_created;
+
+		if (load_body(p) == -1 ||
+		    format_date(p->created, &p_created) == -1) {
+			goto error;
+		}
+
+		buf_appendf(&out, "<article class=\"preview\">\n"
+		    "<h2><a href=\"%s", x.base_url);
+		escape_appends(&out, p->htpath);
+		buf_appends(&out, "\">");
+		escape_appends(&out, p->title);
+		buf_appendf(&out, "</a></h2>\n"
+		    "<p class=\"byline\">Created "
+		    "<date datetime=\"%s\">%s</date>",
+		    p_created.iso, p_created.readable);
+		if (!x.hide_user) {
+			buf_appends(&out, " by ");
+			escape_appends(&out, p->user);
 		}
-		if (fprintf(out, "<updated>%s</updated>\n",
-		    p->modified_iso) < 0) {
-			goto efprintf;
+		buf_appends(&out, "</p>\n");
+		buf_append(&out, p->body + p->excerpt_off,
+		    p->excerpt_end - p->excerpt_off);
+		if (p->excerpt_more) {
+			buf_appends(&out, "\n<p class=\"cont\"><em>"
+			    "Continued...</em></p>");
 		}
-		if (fputs("\n<content type=\"html\">\n", out) < 0) {
-			goto efputs;
+		buf_appends(&out, "\n</article>\n");
+	}
+
+	template_expand(&x.footer, vars, &out);
+
+	if (output_write(filename, out.data, out.len) == -1) {
+		goto error;
+	}
+	stats_add(STATS_WRITTEN, out.len);
+
+end:
+	buf_free(&out);
+	buf_free(&esc);
+	return ret;
+error:
+	ret = -1;
+	goto end;
+}
+
+static int
+create_feed(void)
+{
+	int ret = 0;
+	struct buf out;
+	struct date_str unused;
+	struct date_str updated;
+	size_t count = x.sorted_count < x.feed_count ?
+	    x.sorted_count : x.feed_count;
+
+	if (format_newest(x.sorted, count, &unused, &updated) == -1) {
+		return -1;
+	}
+
+	buf_init(&out, 4096);
+	buf_appendf(&out, "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+	    "<feed xmlns=\"http://www.w3.org/2005/Atom\">\n"
+	    "<title>%s</title>\n"
+	    "<id>%s</id>\n"
+	    "<link href=\"%s/\" />\n"
+	    "<link rel=\"self\" href=\"%s/atom.xml\" />\n",
+	    x.feed_title, x.base_url, x.base_url, x.base_url);
+	if (!x.hide_user) {
+		buf_appends(&out, "<author>\n"
+		    "\t<name>");
+		escape_appends(&out, getlogin());
+		buf_appends(&out, "</name>\n"
+		    "</author>\n");
+	}
+	buf_appendf(&out, "<updated>%s</updated>\n", updated.iso);
+
+	for (size_t i = 0; i < count; ++i) {
+		struct page *p = x.sorted[i];
+		struct date_str p_created;
+		struct date_str p_modified;
+
+		if (load_body(p) == -1 ||
+		    format_date(p->created, &p_created) == -1 ||
+		    format_date(p->modified, &p_modified) == -1) {
+			goto error;
 		}
-		if (fputs(p->body, out) < 0) {
-			goto efputs;
+		buf_appends(&out, "\n<entry>\n"
+		    "<title>");
+		escape_appends(&out, p->title);
+		buf_appendf(&out, "</title>\n"
+		    "<link href=\"%s", x.base_url);
+		escape_appends(&out, p->htpath);
+		buf_appendf(&out, "\" />\n"
+		    "<id>%s", x.base_url);
+		escape_appends(&out, p->htpath);
+		buf_appends(&out, "</id>\n");
+		if (!x.hide_user) {
+			buf_appends(&out, "<author>\n"
+			    "\t<name>");
+			escape_appends(&out, p->user);
+			buf_appends(&out, "</name>\n"
+			    "</author>\n");
 		}
-		if (fputs("</content>\n", out) < 0) goto efputs;
-		if (fputs("</entry>\n", out) < 0) goto efputs;
+		buf_appendf(&out, "<published>%s</published>\n"
+		    "<updated>%s</updated>\n"
+		    "\n<content type=\"html\">\n",
+		    p_created.iso, p_modified.iso);
+		/* the content is HTML, carried as text */
+		escape_append(&out, p->body, p->body_len);
+		buf_appends(&out, "</content>\n"
+		    "</entry>\n");
 	}
 
-	if (fputs("</feed>\n", out) < 0) goto efputs;
+	buf_appends(&out, "</feed>\n");
+
+	if (output_write("./build/atom.xml", out.data, out.len) == -1) {
+		goto error;
+	}
+	stats_add(STATS_WRITTEN, out.len);
 
 end:
-	fclose(out);
+	buf_free(&out);
 	return ret;
-efprintf:
-	perror("fprintf");
-	goto error;
-efputs:
-	perror("fputs");
-	goto error;
 error:
 	ret = -1;
 	goto end;
 }
 
+/* Write the search index, from the terms each page was broken into */
 static int
-compare_page_dates(const void *v1, const void *v2)
+create_search(void)
 {
-	const struct page *p1 = v1;
-	const struct page *p2 = v2;
+	struct search_page *pages;
+	int ret;
 
-	if (p1->created > p2->created) {
+	if (mkdir("./build/search", S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) ==
+	    -1 && errno != EEXIST) {
+		perror("./build/search");
 		return -1;
 	}
-	if (p1->created < p2->created) {
-		return 1;
+
+	pages = xreallocarray(NULL, x.page_count == 0 ? 1 : x.page_count,
+	    sizeof(struct search_page));
+	for (size_t i = 0; i < x.page_count; ++i) {
+		pages[i].htpath = x.pages[i]->htpath;
+		pages[i].title = x.pages[i]->title;
+		pages[i].hash = search_key(x.pages[i]);
+		pages[i].terms = &x.pages[i]->terms;
+	}
+	if (search_store_same(&x.search_store, pages, x.page_count)) {
+		x.search_shards = x.search_store.shards;
+		free(pages);
+		return 0;
+	}
+
+	ret = search_write("./build/search", pages, x.page_count,
+	    &x.search_shards);
+	if (ret == 0) {
+		ret = search_store_save("./build/.search", pages,
+		    x.page_count, x.search_shards);
+	}
+	if (ret == 0 && x.watch) {
+		/* the next rebuild compares against this one */
+		search_store_free(&x.search_store);
+		ret = search_store_load(&x.search_store, "./build/.search");
+	}
+	free(pages);
+	return ret;
+}
+
+/*
+ * Remove the pages whose source has gone, and list everything that changed
+ * in build/.changes. What -a and -i make is only swept while they are on,
+ * for archive parts and shards which are no longer needed: leaving an
+ * option off doesn't remove what it made before.
+ */
+static int
+sweep_outputs(void)
+{
+	char **current;
+	char **names = NULL;
+	size_t count = 0;
+	int ret;
+
+	current = xreallocarray(NULL, x.page_count + x.shard_count +
+	    x.search_shards + 3, sizeof(char *));
+	for (size_t i = 0; i < x.page_count; ++i) {
+		current[count++] = x.pages[i]->htpath + 1;
+	}
+	ret = output_sweep("./build/.outputs", current, count);
+
+	if (ret == 0 && x.archived) {
+		count = 0;
+		current[count++] = "archive.html";
+		for (size_t i = 0; i < x.shard_count; ++i) {
+			current[count++] = x.shards[i].name;
+		}
+		ret = output_sweep("./build/.outputs-archive", current, count);
+	}
+	if (ret == 0 && x.search) {
+		count = 0;
+		current[count++] = "search/index";
+		current[count++] = "search/pages";
+		names = xreallocarray(NULL, x.search_shards + 1,
+		    sizeof(char *));
+		for (size_t i = 0; i < x.search_shards; ++i) {
+			xasprintf(&names[i], "search/terms-%zu", i);
+			current[count++] = names[i];
+		}
+		ret = output_sweep("./build/.outputs-search", current, count);
+	}
+
+	free(current);
+	for (size_t i = 0; names != NULL && i < x.search_shards; ++i) {
+		free(names[i]);
+	}
+	free(names);
+	if (ret == -1) return -1;
+	return output_report("./build/.changes");
+}
+
+/*
+ * Everything that needs doing once the pages have been built: saving the
+ * state for the next build, and the pages which list other pages.
+ */
+static int
+finish_build(void)
+{
+	uint64_t start;
+
+	if (dates_save(&x.dates, "pswg.dates") == -1) return -1;
+	if (save_manifest() == -1) return -1;
+	if (x.use_cache && cache_trim("./build/.cache",
+	    x.cache_size * 1024 * 1024) == -1) {
+		return -1;
+	}
+
+	start = stats_now();
+	select_newest(newest_needed());
+	stats_time(STATS_SORT, start);
+
+	if (x.archived) {
+		puts("Building archive...");
+		start = stats_now();
+		if (create_archive() == -1) return -1;
+		stats_time(STATS_ARCHIVE, start);
+	}
+
+	if (x.syndicated) {
+		puts("Building feed...");
+		start = stats_now();
+		if (create_feed() == -1) return -1;
+		stats_time(STATS_FEED, start);
+	}
+
+	if (x.make_news) {
+		puts("Building news...");
+		start = stats_now();
+		if (create_news(x.news_is_home ?
+		    "./build/index.html" : "./build/news.html") == -1) {
+			return -1;
+		}
+		stats_time(STATS_NEWS, start);
+	}
+
+	if (x.search) {
+		puts("Building search index...");
+		start = stats_now();
+		if (create_search() == -1) return -1;
+		stats_time(STATS_SEARCH, start);
+	}
+
+	if (sweep_outputs() == -1) return -1;
+
+	/* each rebuild in watch mode gets a report of its own */
+	if (x.stats) {
+		stats_report(stderr, x.stats_json);
+		stats_reset();
+	}
+	return 0;
+}
+
+static struct worker *
+watch_worker(void)
+{
+	return &x.workers[0];
+}
+
+static void
+remove_page(size_t i)
+{
+	char *out_path = NULL;
+
+	xasprintf(&out_path, "./build%s", x.pages[i]->htpath);
+	printf("%s removed\n", x.work[i].rel);
+	if (unlink(out_path) == 0) {
+		output_removed(out_path);
+	} else if (errno != ENOENT) {
+		perror(out_path);
+	}
+	free(out_path);
+
+	free_page(x.pages[i]);
+	pool_put(&x.page_pool, x.pages[i]);
+	free(x.work[i].path);
+	--x.page_count;
+	--x.work_count;
+	memmove(&x.pages[i], &x.pages[i + 1],
+	    (x.page_count - i) * sizeof(struct page *));
+	memmove(&x.work[i], &x.work[i + 1],
+	    (x.work_count - i) * sizeof(struct work));
+}
+
+/* Forget a page, or every page under a directory, which went away */
+static void
+remove_pages(const char *path)
+{
+	size_t len = strlen(path);
+	char *out_dir = NULL;
+
+	for (size_t i = x.work_count; i > 0; --i) {
+		const char *p = x.work[i - 1].path;
+
+		if (strncmp(p, path, len) == 0 &&
+		    (p[len] == '\0' || p[len] == '/')) {
+			remove_page(i - 1);
+		}
+	}
+
+	/* if it was a directory, its output is empty now */
+	xasprintf(&out_dir, "./build/%s", src_relative(path));
+	rmdir(out_dir);
+	free(out_dir);
+}
+
+/* Rebuild a single page which was changed or added */
+static int
+update_page(const char *path)
+{
+	struct stat st;
+	struct page *page;
+	size_t found;
+	size_t i;
+
+	if (stat(path, &st) == -1 || !S_ISREG(st.st_mode)) {
+		return 0;
+	}
+
+	for (i = 0; i < x.work_count; ++i) {
+		if (strcmp(x.work[i].path, path) == 0) break;
+	}
+	if (i == x.work_count) {
+		if (x.work_count >= x.work_bufsize) {
+			x.work_bufsize = x.work_bufsize == 0 ?
+			    16 : x.work_bufsize * 2;
+			x.work = xreallocarray(x.work,
+			    x.work_bufsize, sizeof(struct work));
+		}
+		x.pages = xreallocarray(x.pages, x.work_count + 1,
+		    sizeof(struct page *));
+		x.pages[i] = pool_get(&x.page_pool);
+		x.work[i].path = xstrdup(path);
+		x.work[i].rel = src_relative(x.work[i].path);
+		++x.work_count;
+		++x.page_count;
+		found = x.found++;
+	} else {
+		free_page(x.pages[i]);
+		found = x.pages[i]->found;
+	}
+
+	page = x.pages[i];
+	memset(page, 0, sizeof(struct page));
+	page->found = found;
+	memcpy(&x.work[i].st, &st, sizeof(struct stat));
+
+	create_page(&x.work[i], page);
+	if (check_page(&x.work[i], page) == -1) {
+		return -1;
+	}
+	if (!page->clean && x.use_cache) {
+		page->body = cache_get("./build/.cache",
+		    cache_key(&x.work[i], page), &page->body_len,
+		    &page->body_map);
+		page->cached = page->body != NULL;
+		if (page->cached) {
+			stats_add(STATS_READ, page->body_len);
+		}
+	}
+	return render_page(&x.work[i], watch_worker(), page);
+}
+
+/* The templates changed, expand them again around every page */
+static int
+reload_templates(void)
+{
+	struct template header;
+	struct template footer;
+
+	if (template_load(&header, "header.html") == -1) return -1;
+	if (template_load(&footer, "footer.html") == -1) {
+		template_free(&header);
+		return -1;
+	}
+	template_free(&x.header);
+	template_free(&x.footer);
+	x.header = header;
+	x.footer = footer;
+	x.inputs = hash_inputs();
+
+	for (size_t i = 0; i < x.page_count; ++i) {
+		struct page *p = x.pages[i];
+
+		if (load_body(p) == -1) return -1;
+		p->clean = false;
+		p->cached = true;
+		if (render_page(&x.work[i], watch_worker(), p) == -1) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Stay around after the build, rebuilding whatever changes. Page metadata
+ * and bodies are kept, so only the pages affected are parsed again.
+ * Failures are reported, but only end the watch if it can't go on.
+ */
+static int
+watch_site(void)
+{
+	struct watch w;
+
+	if (watch_open(&w, "./src") == -1) {
+		watch_close(&w);
+		return -1;
+	}
+	puts("Watching for changes...");
+
+	while (watch_wait(&w, 20) == 0) {
+		bool templates = false;
+		int failed = 0;
+
+		/* directories first, the pages inside them need them */
+		for (size_t i = 0; i < w.event_count; ++i) {
+			char *out_dir = NULL;
+
+			if (w.events[i].type != WATCH_DIR_ADDED) continue;
+
+			xasprintf(&out_dir, "./build/%s",
+			    src_relative(w.events[i].path));
+			if (mkdir(out_dir, S_IRWXU | S_IRWXG | S_IROTH |
+			    S_IXOTH) == -1 && errno != EEXIST) {
+				perror(out_dir);
+				failed = -1;
+			}
+			free(out_dir);
+		}
+
+		for (size_t i = 0; i < w.event_count; ++i) {
+			const struct watch_event *ev = &w.events[i];
+
+			switch (ev->type) {
+				case WATCH_CHANGED:
+					if (update_page(ev->path) == -1) {
+						failed = -1;
+					}
+					break;
+				case WATCH_REMOVED:
+					remove_pages(ev->path);
+					break;
+				case WATCH_TEMPLATE:
+					templates = true;
+					break;
+				case WATCH_DIR_ADDED:
+					break;
+			}
+		}
+
+		if (templates && reload_templates() == -1) {
+			failed = -1;
+		}
+		if (finish_build() == -1) {
+			failed = -1;
+		}
+		if (failed == -1) {
+			fprintf(stderr, "%s: rebuild failed\n", x.program);
+		}
+		fflush(stdout);
+	}
+
+	watch_close(&w);
+	return -1;
+}
+
+static int
+parse_count(const char *str, size_t *count)
+{
+	char *end;
+	unsigned long long n;
+
+	errno = 0;
+	n = strtoull(str, &end, 10);
+	if (errno != 0 || *end != '\0' || *str == '-' || *str == '\0' ||
+	    n > SIZE_MAX) {
+		fprintf(stderr, "%s: invalid page count: %s\n", x.program, str);
+		return -1;
 	}
+	*count = (size_t)n;
 	return 0;
 }
 
@@ -730,91 +1996,244 @@ main(int argc, char **argv)
 {
 	int ch;
 	int ret = 0;
-	bool archived = false;
-	bool syndicated = false;
-	bool make_news = false;
-	bool news_is_home = false;
+	long jobs;
+	char *end;
+	unsigned long long cache_size;
+	size_t coprocs_started = 0;
+	struct buf base_url = {0};
+	struct buf feed_title = {0};
+	struct walk tree = {0};
+	uint64_t start;
 
 	x.program = argv[0];
 	x.base_url = "";
 	x.parser = "cat";
-
-	while ((ch = getopt(argc, argv, "ab:fhnp:t:u")) != -1) {
+	x.jobs = 1;
+	x.cache_size = 256;
+	x.news_count = NEWS_PAGES;
+	x.feed_count = FEED_PAGES;
+	pthread_mutex_init(&x.work_lock, NULL);
+	pool_init(&x.page_pool, &x.arena, sizeof(struct page));
+
+	while ((ch = getopt(argc, argv, "ab:C:fF:hij:mnN:p:P:s:t:uw")) != -1) {
 		switch (ch) {
 			case 'a':
-				archived = true;
+				x.archived = true;
 				break;
 			case 'b':
 				x.base_url = optarg;
 				break;
+			case 'C':
+				errno = 0;
+				cache_size = strtoull(optarg, &end, 10);
+				if (errno != 0 || *end != '\0' ||
+				    *optarg == '-') {
+					fprintf(stderr,
+					    "%s: invalid cache size: %s\n",
+					    x.program, optarg);
+					goto error;
+				}
+				x.cache_size = cache_size;
+				break;
 			case 'f':
-				syndicated = true;
+				x.syndicated = true;
+				break;
+			case 'F':
+				if (parse_count(optarg, &x.feed_count) == -1) {
+					goto error;
+				}
 				break;
 			case 'h':
-				make_news = true;
-				news_is_home = true;
+				x.make_news = true;
+				x.news_is_home = true;
+				break;
+			case 'i':
+				x.search = true;
+				break;
+			case 'j':
+				errno = 0;
+				jobs = strtol(optarg, &end, 10);
+				if (errno != 0 || *end != '\0' || jobs < 1) {
+					fprintf(stderr,
+					    "%s: invalid job count: %s\n",
+					    x.program, optarg);
+					goto error;
+				}
+				x.jobs = (size_t)jobs;
+				break;
+			case 'm':
+				x.markdown = true;
 				break;
 			case 'n':
-				make_news = true;
-				news_is_home = false;
+				x.make_news = true;
+				x.news_is_home = false;
+				break;
+			case 'N':
+				if (parse_count(optarg, &x.news_count) == -1) {
+					goto error;
+				}
 				break;
 			case 'p':
 				x.parser = optarg;
+				x.coproc_mode = false;
+				x.markdown = false;
+				break;
+			case 'P':
+				x.parser = optarg;
+				x.coproc_mode = true;
+				x.markdown = false;
 				break;
 			case 't':
 				x.feed_title = optarg;
 				break;
+			case 's':
+				if (strcmp(optarg, "json") == 0) {
+					x.stats_json = true;
+				} else if (strcmp(optarg, "text") != 0) {
+					fprintf(stderr,
+					    "%s: invalid stats format: %s\n",
+					    x.program, optarg);
+					goto error;
+				}
+				x.stats = true;
+				break;
 			case 'u':
 				x.hide_user = true;
 				break;
+			case 'w':
+				x.watch = true;
+				break;
 		}
 	}
 	argc -= optind;
 	argv += optind;
 
+	if (x.stats) stats_enable();
+
 	if (mkdir("./build", S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) == -1) {
 		if (errno != EEXIST) {
 			perror("mkdir");
 			goto error;
 		}
 	}
+	output_init("./build");
 
-	if (ftw("./src", traverse, 8) == -1) {
-		perror("ftw");
+	if (template_load(&x.header, "header.html") == -1 ||
+	    template_load(&x.footer, "footer.html") == -1) {
 		goto error;
 	}
 
-	if (archived) {
-		puts("Building archive...");
-		if (create_archive() == -1) goto error;
+	/*
+	 * cat(1) would only copy the file, so it isn't run at all; caching
+	 * its output would only make things slower as well, as it would for
+	 * markdown rendered in-process.
+	 */
+	x.use_plugin = !x.coproc_mode && !x.markdown &&
+	    plugin_named(x.parser);
+	x.in_process = x.markdown || x.use_plugin;
+	x.identity = !x.coproc_mode && !x.in_process &&
+	    strcmp(x.parser, "cat") == 0;
+	x.use_cache = x.cache_size > 0 && !x.identity && !x.markdown;
+	if (x.use_cache && cache_open("./build/.cache") == -1) {
+		goto error;
 	}
 
-	qsort(x.pages, x.page_count, sizeof(struct page),
-	    compare_page_dates);
+	if (dates_load(&x.dates, "pswg.dates") == -1) goto error;
 
-	if (syndicated) {
-		puts("Building feed...");
-		if (x.feed_title == NULL) {
-			fprintf(stderr,
-			    "%s: no feed title specified, use -t title\n",
-			    x.program);
-			goto error;
-		}
-		if (create_feed() == -1) goto error;
+	/* both only ever go into markup, so are escaped once here */
+	escape_appends(&base_url, x.base_url);
+	x.base_url = base_url.data;
+	if (x.feed_title != NULL) {
+		escape_appends(&feed_title, x.feed_title);
+		x.feed_title = feed_title.data;
 	}
 
-	if (make_news) {
-		puts("Building news...");
-		if (create_news(news_is_home ?
-		    "./build/index.html" : "./build/news.html") == -1) {
-			goto error;
+	x.inputs = hash_inputs();
+	if (manifest_load(&x.manifest, "./build/.manifest") == -1) {
+		goto error;
+	}
+	if (x.search &&
+	    search_store_load(&x.search_store, "./build/.search") == -1) {
+		goto error;
+	}
+
+	if (x.use_plugin && plugin_load(&x.plugin, x.parser) == -1) {
+		goto error;
+	}
+
+	x.workers = xreallocarray(NULL, x.jobs, sizeof(struct worker));
+	memset(x.workers, 0, x.jobs * sizeof(struct worker));
+
+	if (x.coproc_mode) {
+		/* a dead parser should be reported, not kill us */
+		signal(SIGPIPE, SIG_IGN);
+		x.coprocs = xreallocarray(NULL, x.jobs, sizeof(struct coproc));
+		for (; coprocs_started < x.jobs; ++coprocs_started) {
+			if (coproc_start(&x.coprocs[coprocs_started],
+			    x.parser) == -1) {
+				goto error;
+			}
+			x.workers[coprocs_started].cp =
+			    &x.coprocs[coprocs_started];
+			stats_add(STATS_PROCESSES, 1);
 		}
 	}
+
+	if (x.syndicated && x.feed_title == NULL) {
+		fprintf(stderr, "%s: no feed title specified, use -t title\n",
+		    x.program);
+		goto error;
+	}
+
+	start = stats_now();
+	if (walk_tree(&tree, "./src", x.jobs) == -1 ||
+	    collect_pages(&tree) == -1) {
+		goto error;
+	}
+	stats_time(STATS_WALK, start);
+
+	/* keep the dates of new pages even if some failed to build */
+	if (build_pages() == -1) {
+		dates_save(&x.dates, "pswg.dates");
+		goto error;
+	}
+	if (finish_build() == -1) goto error;
+
+	if (x.watch && watch_site() == -1) goto error;
 end:
+	for (size_t i = 0; i < coprocs_started; ++i) {
+		if (coproc_stop(&x.coprocs[i]) == -1) {
+			ret = 1;
+		}
+	}
+	free(x.coprocs);
+	plugin_unload(&x.plugin);
+	for (size_t i = 0; x.workers != NULL && i < x.jobs; ++i) {
+		markdown_free(&x.workers[i].md);
+		buf_free(&x.workers[i].out);
+		search_scratch_free(&x.workers[i].search);
+	}
+	free(x.workers);
 	for (size_t i = 0; i < x.page_count; ++i) {
-		free_page(&x.pages[i]);
+		free_page(x.pages[i]);
 	}
 	free(x.pages);
+	free(x.owners);
+	free(x.shards);
+	arena_free(&x.arena);
+	free(x.sorted);
+	for (size_t i = 0; i < x.work_count; ++i) {
+		free(x.work[i].path);
+	}
+	free(x.work);
+	manifest_free(&x.manifest);
+	search_store_free(&x.search_store);
+	dates_free(&x.dates);
+	template_free(&x.header);
+	template_free(&x.footer);
+	buf_free(&base_url);
+	buf_free(&feed_title);
+	walk_free(&tree);
 	return ret;
 error:
 	ret = 1;
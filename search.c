@@ -0,0 +1,685 @@
+/*
+ * Copyright (c) 2015 Scarletts <scarlett@entering.space>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * A search index for the site, which a browser can fetch in pieces. Each
+ * page's body is broken into terms as it is rendered, and once all pages
+ * are, the terms are gathered into an inverted index:
+ *
+ *	index		"PSI1", the number of pages and of shards, and the
+ *			first term in each shard
+ *	pages		"PSP1", the number of pages, then each page's path
+ *			and title; a page's number is its place here
+ *	terms-N		"PST1", the number of terms in shard N, then for
+ *			each term in order, how many bytes it shares with
+ *			the one before, the rest of it, how many pages it
+ *			is in, and their numbers, each as the difference
+ *			from the one before
+ *
+ * Numbers are unsigned varints, seven bits to a byte with the least
+ * significant first, and strings a varint length and the bytes. So to
+ * look up a term, fetch index, find the last shard starting at or before
+ * it, and fetch just that shard.
+ *
+ * Terms are runs of ASCII letters and digits, lowercased, and of any
+ * other UTF-8 characters, outside markup.
+ *
+ * So that pages which weren't rebuilt needn't be read back and broken up
+ * again, each page's terms are also kept in a store for the next build, a
+ * text file starting with its version and the number of shards, then a
+ * line for each page:
+ *
+ *	hash terms htpath
+ *
+ * tab separated, with hash that of the page's source and the terms
+ * separated by spaces.
+ */
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <errno.h>
+
+#include "xalloc.h"
+#include "buf.h"
+#include "util.h"
+#include "hash.h"
+#include "output.h"
+#include "search.h"
+
+#define SEARCH_STORE_VERSION "pswg-search 1"
+#define FNV_BASIS	2166136261u
+#define FNV_PRIME	16777619u
+
+struct term {
+	const char *s;
+	uint32_t hash;
+	size_t count;	/* pages it is in */
+	size_t start;	/* of its pages in the postings */
+};
+
+static bool
+word_char(char c)
+{
+	return isalnum((unsigned char)c) || (unsigned char)c >= 0x80;
+}
+
+/* Find the end tag of the element named name, case aside */
+static const char *
+end_tag(const char *p, const char *end, const char *name, size_t len)
+{
+	for (; p + len + 2 <= end; ++p) {
+		if (p[0] == '<' && p[1] == '/' &&
+		    strncasecmp(p + 2, name, len) == 0) {
+			return p;
+		}
+	}
+	return end;
+}
+
+/* Skip over the tag at p, and the contents of any script or style */
+static const char *
+skip_tag(const char *p, const char *end)
+{
+	const char *q = memchr(p, '>', (size_t)(end - p));
+
+	if (q == NULL) return end;
+	++q;
+	if (q - p > 7 && strncasecmp(p + 1, "script", 6) == 0 &&
+	    !word_char(p[7])) {
+		return end_tag(q, end, "script", 6);
+	}
+	if (q - p > 6 && strncasecmp(p + 1, "style", 5) == 0 &&
+	    !word_char(p[6])) {
+		return end_tag(q, end, "style", 5);
+	}
+	return q;
+}
+
+/* Each word is hashed as it is copied, with 32-bit FNV-1a */
+static void
+add_words(struct search_scratch *sc, const char *p, const char *end,
+    bool markup)
+{
+	struct buf *text = &sc->text;
+	size_t start;
+	uint32_t h;
+	const char *q;
+	char c;
+
+	while (p < end) {
+		if (markup && *p == '<') {
+			p = skip_tag(p, end);
+			continue;
+		}
+		if (markup && *p == '&') {
+			/* entities only separate words */
+			for (q = p + 1; q < end && q - p < 12 &&
+			    (isalnum((unsigned char)*q) || *q == '#'); ++q);
+			p = q < end && *q == ';' ? q + 1 : p + 1;
+			continue;
+		}
+		if (!word_char(*p)) {
+			++p;
+			continue;
+		}
+
+		start = text->len;
+		h = FNV_BASIS;
+		buf_reserve(text, SEARCH_TERM_MAX + 1);
+		for (; p < end && word_char(*p); ++p) {
+			if (text->len - start < SEARCH_TERM_MAX + 1) {
+				c = (char)tolower((unsigned char)*p);
+				text->data[text->len++] = c;
+				h = (h ^ (unsigned char)c) * FNV_PRIME;
+			}
+		}
+		if (text->len - start < SEARCH_TERM_MIN ||
+		    text->len - start > SEARCH_TERM_MAX) {
+			text->len = start;
+			continue;
+		}
+		text->data[text->len++] = '\0';
+
+		if (sc->count >= sc->bufsize) {
+			sc->bufsize = sc->bufsize == 0 ? 256 : sc->bufsize * 2;
+			sc->offsets = xreallocarray(sc->offsets,
+			    sc->bufsize, sizeof(size_t));
+			sc->hashes = xreallocarray(sc->hashes,
+			    sc->bufsize, sizeof(uint32_t));
+		}
+		sc->offsets[sc->count] = start;
+		sc->hashes[sc->count++] = h;
+	}
+}
+
+/*
+ * Break the title and body of a page into its distinct terms. The scratch
+ * space is only for this thread, so pages can be tokenized in parallel.
+ */
+void
+search_tokenize(struct search_scratch *sc, const char *title,
+    const char *body, size_t len, struct search_terms *out)
+{
+	const char *text;
+	size_t mask;
+	size_t n = 0;
+	size_t size = 0;
+	size_t slot;
+	char *p;
+
+	sc->text.len = 0;
+	sc->count = 0;
+	add_words(sc, title, title + strlen(title), false);
+	add_words(sc, body, body + len, true);
+	text = sc->text.data;
+
+	/* a table at most half full, of the first of each word seen */
+	for (mask = 16; mask < sc->count * 2; mask <<= 1);
+	if (mask > sc->table_size) {
+		sc->table_size = mask;
+		sc->table = xreallocarray(sc->table, mask, sizeof(size_t));
+	}
+	memset(sc->table, 0, mask * sizeof(size_t));
+	--mask;
+
+	for (size_t i = 0; i < sc->count; ++i) {
+		const char *w = text + sc->offsets[i];
+		size_t j;
+
+		for (slot = sc->hashes[i] & mask; (j = sc->table[slot]) != 0;
+		    slot = (slot + 1) & mask) {
+			if (sc->hashes[j - 1] == sc->hashes[i] &&
+			    strcmp(text + sc->offsets[j - 1], w) == 0) {
+				break;
+			}
+		}
+		if (j != 0) continue;
+
+		sc->table[slot] = n + 1;
+		sc->offsets[n] = sc->offsets[i];
+		sc->hashes[n++] = sc->hashes[i];
+		size += strlen(w) + 1;
+	}
+
+	out->data = p = xmalloc(size == 0 ? 1 : size);
+	out->hashes = xreallocarray(NULL, n == 0 ? 1 : n, sizeof(uint32_t));
+	out->count = n;
+	for (size_t i = 0; i < n; ++i) {
+		const char *w = text + sc->offsets[i];
+		size_t wlen = strlen(w) + 1;
+
+		memcpy(p, w, wlen);
+		p += wlen;
+		out->hashes[i] = sc->hashes[i];
+	}
+}
+
+void
+search_scratch_free(struct search_scratch *sc)
+{
+	buf_free(&sc->text);
+	free(sc->offsets);
+	free(sc->hashes);
+	free(sc->table);
+}
+
+void
+search_terms_free(struct search_terms *t)
+{
+	free(t->data);
+	free(t->hashes);
+	t->data = NULL;
+	t->hashes = NULL;
+	t->count = 0;
+}
+
+static void
+put_varint(struct buf *b, uint64_t n)
+{
+	char c;
+
+	do {
+		c = (char)(n & 0x7f);
+		n >>= 7;
+		if (n != 0) c |= (char)0x80;
+		buf_append(b, &c, 1);
+	} while (n != 0);
+}
+
+static void
+put_string(struct buf *b, const char *s, size_t len)
+{
+	put_varint(b, len);
+	buf_append(b, s, len);
+}
+
+static int
+compare_terms(const void *v1, const void *v2)
+{
+	return strcmp((*(const struct term *const *)v1)->s,
+	    (*(const struct term *const *)v2)->s);
+}
+
+/*
+ * Find the term s in the table, adding it if it isn't there. The table
+ * has room for twice as many terms as there can be, so never fills up.
+ */
+static size_t
+intern(size_t *table, size_t mask, struct term *terms, size_t *count,
+    const char *s, uint32_t hash)
+{
+	size_t i = hash & mask;
+
+	for (; table[i] != 0; i = (i + 1) & mask) {
+		const struct term *t = &terms[table[i] - 1];
+
+		if (t->hash == hash && strcmp(t->s, s) == 0) {
+			return table[i] - 1;
+		}
+	}
+	terms[*count].s = s;
+	terms[*count].hash = hash;
+	terms[*count].count = 0;
+	table[i] = ++*count;
+	return *count - 1;
+}
+
+static int
+write_file(const char *dir, const char *name, const struct buf *b)
+{
+	char *path = NULL;
+	int ret;
+
+	xasprintf(&path, "%s/%s", dir, name);
+	ret = output_write(path, b->data, b->len);
+	free(path);
+	return ret;
+}
+
+/*
+ * Write the index for pages into dir, as described at the top. The
+ * number of term shards written is stored in *shards.
+ */
+int
+search_write(const char *dir, const struct search_page *pages, size_t count,
+    size_t *shards)
+{
+	struct term *terms;
+	struct term **sorted;
+	size_t *ids;
+	size_t *postings;
+	size_t *table;
+	size_t total = 0;
+	size_t nterms = 0;
+	size_t mask;
+	size_t k = 0;
+	size_t first;
+	struct buf index = {0};
+	struct buf out = {0};
+	struct buf shard = {0};
+	char name[32];
+	int ret = 0;
+
+	for (size_t i = 0; i < count; ++i) {
+		total += pages[i].terms->count;
+	}
+	for (mask = 1; mask < total * 2; mask <<= 1);
+	--mask;
+
+	/* number every occurrence's term, then lay out the postings */
+	table = xreallocarray(NULL, mask + 1, sizeof(size_t));
+	memset(table, 0, (mask + 1) * sizeof(size_t));
+	terms = xreallocarray(NULL, total == 0 ? 1 : total,
+	    sizeof(struct term));
+	ids = xreallocarray(NULL, total == 0 ? 1 : total, sizeof(size_t));
+	for (size_t i = 0; i < count; ++i) {
+		const char *s = pages[i].terms->data;
+
+		for (size_t j = 0; j < pages[i].terms->count; ++j) {
+			ids[k] = intern(table, mask, terms, &nterms, s,
+			    pages[i].terms->hashes[j]);
+			++terms[ids[k++]].count;
+			s += strlen(s) + 1;
+		}
+	}
+	free(table);
+
+	first = 0;
+	for (size_t t = 0; t < nterms; ++t) {
+		terms[t].start = first;
+		first += terms[t].count;
+		terms[t].count = 0;
+	}
+	postings = xreallocarray(NULL, total == 0 ? 1 : total,
+	    sizeof(size_t));
+	k = 0;
+	for (size_t i = 0; i < count; ++i) {
+		for (size_t j = 0; j < pages[i].terms->count; ++j) {
+			struct term *t = &terms[ids[k++]];
+
+			postings[t->start + t->count++] = i;
+		}
+	}
+	free(ids);
+
+	sorted = xreallocarray(NULL, nterms == 0 ? 1 : nterms,
+	    sizeof(struct term *));
+	for (size_t t = 0; t < nterms; ++t) {
+		sorted[t] = &terms[t];
+	}
+	qsort(sorted, nterms, sizeof(struct term *), compare_terms);
+
+	/* the shards, each starting with a whole term */
+	*shards = 0;
+	for (size_t t = 0; t < nterms && ret == 0; t = k) {
+		const char *prev = "";
+
+		shard.len = 0;
+		for (k = t; k < nterms && shard.len < SEARCH_SHARD_SIZE; ++k) {
+			const struct term *term = sorted[k];
+			size_t shared = 0;
+			size_t last = 0;
+			size_t len = strlen(term->s);
+
+			while (prev[shared] != '\0' &&
+			    prev[shared] == term->s[shared]) {
+				++shared;
+			}
+			put_varint(&shard, shared);
+			put_string(&shard, term->s + shared, len - shared);
+			put_varint(&shard, term->count);
+			for (size_t p = 0; p < term->count; ++p) {
+				size_t id = postings[term->start + p];
+
+				put_varint(&shard, id - last);
+				last = id;
+			}
+			prev = term->s;
+		}
+
+		out.len = 0;
+		buf_append(&out, "PST1", 4);
+		put_varint(&out, k - t);
+		buf_append(&out, shard.data, shard.len);
+		snprintf(name, sizeof(name), "terms-%zu", *shards);
+		ret = write_file(dir, name, &out);
+
+		put_string(&index, sorted[t]->s, strlen(sorted[t]->s));
+		++*shards;
+	}
+
+	if (ret == 0) {
+		out.len = 0;
+		buf_append(&out, "PSP1", 4);
+		put_varint(&out, count);
+		for (size_t i = 0; i < count; ++i) {
+			put_string(&out, pages[i].htpath,
+			    strlen(pages[i].htpath));
+			put_string(&out, pages[i].title,
+			    strlen(pages[i].title));
+		}
+		ret = write_file(dir, "pages", &out);
+	}
+
+	if (ret == 0) {
+		out.len = 0;
+		buf_append(&out, "PSI1", 4);
+		put_varint(&out, count);
+		put_varint(&out, *shards);
+		if (index.len > 0) {
+			buf_append(&out, index.data, index.len);
+		}
+		ret = write_file(dir, "index", &out);
+	}
+
+	free(sorted);
+	free(postings);
+	free(terms);
+	buf_free(&index);
+	buf_free(&out);
+	buf_free(&shard);
+	return ret;
+}
+
+static void
+index_stored(struct search_store *st)
+{
+	st->table_size = 16;
+	while (st->table_size < st->count * 2) {
+		st->table_size *= 2;
+	}
+	st->table = xreallocarray(NULL, st->table_size, sizeof(size_t));
+	for (size_t i = 0; i < st->table_size; ++i) {
+		st->table[i] = SIZE_MAX;
+	}
+	for (size_t i = 0; i < st->count; ++i) {
+		size_t slot = hash_str(st->entries[i].htpath, 0) &
+		    (st->table_size - 1);
+
+		while (st->table[slot] != SIZE_MAX) {
+			slot = (slot + 1) & (st->table_size - 1);
+		}
+		st->table[slot] = i;
+	}
+}
+
+static int
+parse_stored(char *line, struct search_stored *e)
+{
+	char *p;
+	char *end;
+
+	errno = 0;
+	e->hash = strtoull(line, &end, 16);
+	if (errno != 0 || end == line || *end != '\t') return -1;
+	e->terms = end + 1;
+	if ((p = strchr(e->terms, '\t')) == NULL || p[1] == '\0') return -1;
+	e->len = (size_t)(p - e->terms);
+	e->htpath = p + 1;
+	return 0;
+}
+
+/*
+ * Load the terms kept by the last build. Like the manifest, a missing or
+ * unreadable store only means every page is broken up again.
+ */
+int
+search_store_load(struct search_store *st, const char *path)
+{
+	char *line, *next;
+	size_t bufsize = 0;
+
+	memset(st, 0, sizeof(struct search_store));
+
+	if (access(path, F_OK) == -1 ||
+	    (st->text = read_file(path, NULL)) == NULL) {
+		index_stored(st);
+		return 0;
+	}
+
+	line = st->text;
+	if ((next = strchr(line, '\n')) == NULL ||
+	    strncmp(line, SEARCH_STORE_VERSION " ",
+	    sizeof(SEARCH_STORE_VERSION)) != 0) {
+		fprintf(stderr, "%s: unknown format, ignoring it\n", path);
+		index_stored(st);
+		return 0;
+	}
+	st->shards = strtoul(line + sizeof(SEARCH_STORE_VERSION), NULL, 10);
+
+	for (line = next + 1; *line != '\0'; line = next + 1) {
+		if ((next = strchr(line, '\n')) == NULL) break;
+		*next = '\0';
+
+		if (st->count >= bufsize) {
+			bufsize = bufsize == 0 ? 64 : bufsize * 2;
+			st->entries = xreallocarray(st->entries, bufsize,
+			    sizeof(struct search_stored));
+		}
+		if (parse_stored(line, &st->entries[st->count]) == 0) {
+			++st->count;
+		}
+	}
+
+	index_stored(st);
+	return 0;
+}
+
+/* Fill in terms from the store, if the page is there with the same hash */
+bool
+search_store_find(const struct search_store *st, const char *htpath,
+    uint64_t hash, struct search_terms *terms)
+{
+	const struct search_stored *e = NULL;
+	size_t slot = hash_str(htpath, 0) & (st->table_size - 1);
+	size_t n = 0;
+	uint32_t h = FNV_BASIS;
+	char *p;
+
+	for (; st->table[slot] != SIZE_MAX;
+	    slot = (slot + 1) & (st->table_size - 1)) {
+		if (strcmp(st->entries[st->table[slot]].htpath, htpath) == 0) {
+			e = &st->entries[st->table[slot]];
+			break;
+		}
+	}
+	if (e == NULL || e->hash != hash) return false;
+
+	for (size_t i = 0; i < e->len; ++i) {
+		if (e->terms[i] == ' ') ++n;
+	}
+	n += e->len > 0;
+
+	terms->data = xmalloc(e->len + 1);
+	terms->hashes = xreallocarray(NULL, n == 0 ? 1 : n, sizeof(uint32_t));
+	terms->count = 0;
+	p = terms->data;
+	for (size_t i = 0; i < e->len; ++i) {
+		if (e->terms[i] == ' ') {
+			*p++ = '\0';
+			terms->hashes[terms->count++] = h;
+			h = FNV_BASIS;
+		} else {
+			*p++ = e->terms[i];
+			h = (h ^ (unsigned char)e->terms[i]) * FNV_PRIME;
+		}
+	}
+	*p = '\0';
+	if (e->len > 0) {
+		terms->hashes[terms->count++] = h;
+	}
+	return true;
+}
+
+/*
+ * Whether the index written along with the store would come out the same
+ * for these pages: the same pages in the same order, none of which would
+ * be rebuilt.
+ */
+bool
+search_store_same(const struct search_store *st,
+    const struct search_page *pages, size_t count)
+{
+	if (st->text == NULL || st->count != count) return false;
+
+	for (size_t i = 0; i < count; ++i) {
+		if (st->entries[i].hash != pages[i].hash ||
+		    strcmp(st->entries[i].htpath, pages[i].htpath) != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Keep the terms of pages for the next build, as described at the top */
+int
+search_store_save(const char *path, const struct search_page *pages,
+    size_t count, size_t shards)
+{
+	FILE *fp;
+	char *tmp = NULL;
+	struct buf line = {0};
+	char hash[32];
+	int ret = 0;
+
+	xasprintf(&tmp, "%s.tmp", path);
+	if ((fp = fopen(tmp, "w")) == NULL) {
+		perror(tmp);
+		free(tmp);
+		return -1;
+	}
+	if (fprintf(fp, "%s %zu\n", SEARCH_STORE_VERSION, shards) < 0) {
+		ret = -1;
+	}
+
+	for (size_t i = 0; i < count && ret == 0; ++i) {
+		const struct search_terms *t = pages[i].terms;
+		size_t start;
+		size_t len = 0;
+
+		snprintf(hash, sizeof(hash), "%016" PRIx64 "\t", pages[i].hash);
+		line.len = 0;
+		buf_appends(&line, hash);
+
+		/* the terms are already one block, just separate them */
+		for (size_t j = 0; j < t->count; ++j) {
+			len += strlen(t->data + len) + 1;
+		}
+		start = line.len;
+		if (len > 0) {
+			buf_append(&line, t->data, len - 1);
+		}
+		for (size_t j = start; j < line.len; ++j) {
+			if (line.data[j] == '\0') line.data[j] = ' ';
+		}
+
+		buf_appends(&line, "\t");
+		buf_appends(&line, pages[i].htpath);
+		buf_appends(&line, "\n");
+		if (fwrite(line.data, 1, line.len, fp) != line.len) ret = -1;
+	}
+	if (ret == -1) {
+		perror("fwrite");
+	}
+	buf_free(&line);
+	if (fclose(fp) != 0) {
+		perror("fclose");
+		ret = -1;
+	}
+	if (ret == 0 && rename(tmp, path) == -1) {
+		perror("rename");
+		ret = -1;
+	}
+	free(tmp);
+	return ret;
+}
+
+void
+search_store_free(struct search_store *st)
+{
+	free(st->text);
+	free(st->entries);
+	free(st->table);
+	memset(st, 0, sizeof(struct search_store));
+}
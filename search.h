@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2015 Scarletts <scarlett@entering.space>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef SEARCH_H
+#define SEARCH_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "buf.h"
+
+#define SEARCH_TERM_MIN		2	/* shorter or longer words are left out */
+#define SEARCH_TERM_MAX		32
+#define SEARCH_SHARD_SIZE	32768	/* a shard is started past this */
+
+/* A page's distinct terms, each followed by a NUL, and their hashes */
+struct search_terms {
+	char *data;
+	uint32_t *hashes;
+	size_t count;
+};
+
+/* Room for tokenizing, kept from one page to the next */
+struct search_scratch {
+	struct buf text;
+	size_t *offsets;	/* of the words in text */
+	uint32_t *hashes;
+	size_t count;
+	size_t bufsize;
+	size_t *table;		/* to find words already seen */
+	size_t table_size;
+};
+
+struct search_page {
+	const char *htpath;
+	const char *title;
+	uint64_t hash;		/* changes when its terms might, for the store */
+	const struct search_terms *terms;
+};
+
+/* Each page's terms from the last build, see search_store_load() */
+struct search_stored {
+	const char *htpath;
+	uint64_t hash;
+	const char *terms;
+	size_t len;
+};
+
+struct search_store {
+	size_t shards;		/* of the index written with it */
+	char *text;
+	struct search_stored *entries;
+	size_t count;
+	size_t *table;
+	size_t table_size;
+};
+
+void search_tokenize(struct search_scratch *, const char *, const char *,
+    size_t, struct search_terms *);
+
+void search_scratch_free(struct search_scratch *);
+
+void search_terms_free(struct search_terms *);
+
+int search_write(const char *, const struct search_page *, size_t,
+    size_t *);
+
+int search_store_load(struct search_store *, const char *);
+
+bool search_store_find(const struct search_store *, const char *, uint64_t,
+    struct search_terms *);
+
+bool search_store_same(const struct search_store *, const struct search_page *,
+    size_t);
+
+int search_store_save(const char *, const struct search_page *, size_t,
+    size_t);
+
+void search_store_free(struct search_store *);
+
+#endif
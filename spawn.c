@@ -0,0 +1,310 @@
+/*
+ * Copyright (c) 2015 Scarletts <scarlett@entering.space>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE	/* splice() */
+#endif
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+
+#include "xalloc.h"
+#include "util.h"
+#include "spawn.h"
+
+extern char **environ;
+
+/*
+ * Held while a pipe is being set up and spawned, so that a child spawned
+ * by another thread doesn't inherit our end of it and keep it from
+ * closing.
+ */
+static pthread_mutex_t spawn_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Start args[0], searched for in PATH, with in and out as its stdin and
+ * stdout unless they are -1. Any other descriptors the child shouldn't
+ * have must be close-on-exec.
+ *
+ * Unlike fork(), posix_spawn() doesn't copy our address space, so this
+ * costs the same however many pages are held in memory. Where it can, it
+ * also reports a program that couldn't be run by its return value, rather
+ * than leaving the child to exit unsuccessfully.
+ */
+pid_t
+spawn_process(char *const args[], int in, int out)
+{
+	posix_spawn_file_actions_t actions;
+	pid_t pid;
+	int err;
+
+	if ((err = posix_spawn_file_actions_init(&actions)) != 0) {
+		fprintf(stderr, "posix_spawn_file_actions_init: %s\n",
+		    strerror(err));
+		return -1;
+	}
+	if (in != -1) {
+		err = posix_spawn_file_actions_adddup2(&actions, in,
+		    STDIN_FILENO);
+	}
+	if (err == 0 && out != -1) {
+		err = posix_spawn_file_actions_adddup2(&actions, out,
+		    STDOUT_FILENO);
+	}
+	if (err == 0) {
+		err = posix_spawnp(&pid, args[0], &actions, NULL, args,
+		    environ);
+	}
+	posix_spawn_file_actions_destroy(&actions);
+
+	if (err != 0) {
+		fprintf(stderr, "%s: %s\n", args[0], strerror(err));
+		return -1;
+	}
+	return pid;
+}
+
+static int
+start_job(struct spawn_job *job)
+{
+	int child_pipe[2];
+
+	pthread_mutex_lock(&spawn_lock);
+	if (pipe(child_pipe) == -1) {
+		perror("pipe");
+		pthread_mutex_unlock(&spawn_lock);
+		return -1;
+	}
+	fcntl(child_pipe[0], F_SETFD, FD_CLOEXEC);
+	fcntl(child_pipe[1], F_SETFD, FD_CLOEXEC);
+
+	job->pid = spawn_process(job->args, -1, child_pipe[1]);
+	pthread_mutex_unlock(&spawn_lock);
+
+	close(child_pipe[1]);
+	if (job->pid == -1) {
+		close(child_pipe[0]);
+		return -1;
+	}
+	job->fd = child_pipe[0];
+	return 0;
+}
+
+/* Returns 1 once the child has closed its end, 0 if there is more */
+static int
+read_job(struct spawn_job *job)
+{
+	struct buf *b = &job->out;
+	ssize_t ret;
+
+	/* the buffer doubles, so reads get bigger as the output does */
+	if (b->size - b->len - 1 < 4096) {
+		buf_reserve(b, 4096);
+	}
+	ret = read(job->fd, b->data + b->len, b->size - b->len - 1);
+	if (ret == -1) {
+		if (errno == EINTR || errno == EAGAIN) return 0;
+		perror("read");
+		return -1;
+	}
+	b->len += (size_t)ret;
+	b->data[b->len] = '\0';
+	return ret == 0;
+}
+
+static int
+finish_job(struct spawn_job *job)
+{
+	int status;
+
+	close(job->fd);
+	job->fd = -1;
+	while (waitpid(job->pid, &status, 0) == -1) {
+		if (errno != EINTR) {
+			perror("wait");
+			return -1;
+		}
+	}
+	if (status != 0) {
+		fprintf(stderr,
+		    "spawn: child %s process terminated unsuccessfully\n",
+		    job->args[0]);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Run every job with up to max children at a time, collecting each one's
+ * output as it arrives. done is called as each job finishes successfully,
+ * and owns its output from then on. After a failure no more jobs are
+ * started, but those already running are waited for.
+ */
+int
+spawn_all(struct spawn_job *jobs, size_t count, size_t max,
+    spawn_done_fn done)
+{
+	struct pollfd *fds;
+	struct spawn_job **running;
+	size_t nrunning = 0;
+	size_t next = 0;
+	bool failed = false;
+
+	if (max == 0) max = 1;
+	fds = xreallocarray(NULL, max, sizeof(struct pollfd));
+	running = xreallocarray(NULL, max, sizeof(struct spawn_job *));
+
+	while ((next < count && !failed) || nrunning > 0) {
+		while (nrunning < max && next < count && !failed) {
+			if (start_job(&jobs[next]) == -1) {
+				failed = true;
+				break;
+			}
+			buf_init(&jobs[next].out, 4096);
+			jobs[next].started = now_ns();
+			fds[nrunning].fd = jobs[next].fd;
+			fds[nrunning].events = POLLIN;
+			running[nrunning++] = &jobs[next++];
+		}
+		if (nrunning == 0) break;
+
+		if (poll(fds, (nfds_t)nrunning, -1) == -1) {
+			if (errno == EINTR) continue;
+			perror("poll");
+			failed = true;
+			break;
+		}
+
+		for (size_t i = 0; i < nrunning; ++i) {
+			struct spawn_job *job = running[i];
+			int r;
+
+			if (fds[i].revents == 0) continue;
+
+			if ((r = read_job(job)) == 0) continue;
+
+			if (r == -1 || finish_job(job) == -1 ||
+			    done(job) == -1) {
+				failed = true;
+			}
+			if (r == -1 && job->fd != -1) {
+				finish_job(job);
+			}
+
+			/* move the last running job into this slot */
+			--nrunning;
+			fds[i] = fds[nrunning];
+			running[i] = running[nrunning];
+			--i;
+		}
+	}
+
+	/* something went wrong with poll, don't leave zombies behind */
+	for (size_t i = 0; i < nrunning; ++i) {
+		finish_job(running[i]);
+	}
+
+	free(fds);
+	free(running);
+	return failed ? -1 : 0;
+}
+
+static int
+keep_output(struct spawn_job *job)
+{
+	return 0;
+}
+
+char *
+read_pipe(char *args[], size_t *out_len)
+{
+	struct spawn_job job = {0};
+
+	job.args = args;
+	if (spawn_all(&job, 1, 1, keep_output) == -1) {
+		buf_free(&job.out);
+		return NULL;
+	}
+	return buf_detach(&job.out, out_len);
+}
+
+/* Copy a pipe into fd until it closes, without going through memory */
+static int
+copy_pipe(int in, int out, size_t *out_len)
+{
+	char buf[16384];
+	ssize_t ret;
+
+	*out_len = 0;
+#ifdef __linux__
+	for (;;) {
+		ret = splice(in, NULL, out, NULL, 1 << 20, SPLICE_F_MOVE);
+		if (ret == -1) {
+			if (errno == EINTR) continue;
+			/* fd can't be spliced into, copy it instead */
+			if (errno == EINVAL && *out_len == 0) break;
+			perror("splice");
+			return -1;
+		}
+		if (ret == 0) return 0;
+		*out_len += (size_t)ret;
+	}
+#endif
+	for (;;) {
+		if ((ret = read(in, buf, sizeof(buf))) == -1) {
+			if (errno == EINTR) continue;
+			perror("read");
+			return -1;
+		}
+		if (ret == 0) return 0;
+		if (write_fully(out, buf, (size_t)ret) == -1) return -1;
+		*out_len += (size_t)ret;
+	}
+}
+
+/*
+ * Run a child with its output going into fd as it is produced, rather than
+ * being collected. The number of bytes written is stored in *out_len.
+ */
+int
+spawn_stream(char *args[], int fd, size_t *out_len)
+{
+	struct spawn_job job = {0};
+	int ret = 0;
+
+	job.args = args;
+	if (start_job(&job) == -1) {
+		return -1;
+	}
+	if (copy_pipe(job.fd, fd, out_len) == -1) {
+		ret = -1;
+	}
+	/* closing our end first stops the child if the copy failed */
+	if (finish_job(&job) == -1) {
+		ret = -1;
+	}
+	return ret;
+}
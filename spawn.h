@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2015 Scarletts <scarlett@entering.space>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef SPAWN_H
+#define SPAWN_H
+#include <sys/types.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "buf.h"
+
+struct spawn_job {
+	char **args;
+	void *data;	/* for the caller, to tie the output to its page */
+	struct buf out;
+	uint64_t started;	/* see now_ns() */
+
+	pid_t pid;
+	int fd;
+};
+
+typedef int (*spawn_done_fn)(struct spawn_job *);
+
+pid_t spawn_process(char *const [], int, int);
+
+int spawn_all(struct spawn_job *, size_t, size_t, spawn_done_fn);
+
+char *read_pipe(char **, size_t *);
+
+int spawn_stream(char **, int, size_t *);
+
+#endif
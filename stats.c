@@ -0,0 +1,275 @@
+/*
+ * Copyright (c) 2015 Scarletts <scarlett@entering.space>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Where a build spends its time. Phases which happen once per page are
+ * added up over all pages, and so over all jobs, rather than measured
+ * from start to finish. Nothing is measured until stats_enable() is
+ * called, so that without -s this costs a branch per call.
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "xalloc.h"
+#include "util.h"
+#include "stats.h"
+
+#define STATS_BUCKETS	32	/* parser latencies, up to 2^31 us */
+#define STATS_SLOWEST	10
+
+struct slow_page {
+	char *path;
+	uint64_t ns;
+};
+
+static const char *const phase_names[STATS_PHASES] = {
+	[STATS_WALK] = "walk",
+	[STATS_DATES] = "dates",
+	[STATS_PARSE] = "parse",
+	[STATS_TEMPLATE] = "template",
+	[STATS_WRITE] = "write",
+	[STATS_TOKENIZE] = "tokenize",
+	[STATS_SORT] = "sort",
+	[STATS_ARCHIVE] = "archive",
+	[STATS_NEWS] = "news",
+	[STATS_FEED] = "feed",
+	[STATS_SEARCH] = "search",
+};
+
+static const char *const count_names[STATS_COUNTS] = {
+	[STATS_PAGES] = "pages",
+	[STATS_PROCESSES] = "processes",
+	[STATS_READ] = "bytes_read",
+	[STATS_WRITTEN] = "bytes_written",
+};
+
+static struct {
+	bool enabled;
+	uint64_t start;
+	uint64_t phases[STATS_PHASES];
+	uint64_t counts[STATS_COUNTS];
+	uint64_t buckets[STATS_BUCKETS];
+	struct slow_page slowest[STATS_SLOWEST];	/* slowest first */
+	size_t slow_count;
+	pthread_mutex_t lock;
+} s = {
+	.lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+void
+stats_enable(void)
+{
+	s.enabled = true;
+	s.start = now_ns();
+}
+
+/* The time to pass to stats_time() once something is done */
+uint64_t
+stats_now(void)
+{
+	return s.enabled ? now_ns() : 0;
+}
+
+void
+stats_time(enum stats_phase phase, uint64_t since)
+{
+	uint64_t ns;
+
+	if (!s.enabled) return;
+
+	ns = now_ns() - since;
+	pthread_mutex_lock(&s.lock);
+	s.phases[phase] += ns;
+	pthread_mutex_unlock(&s.lock);
+}
+
+void
+stats_add(enum stats_count count, uint64_t n)
+{
+	if (!s.enabled) return;
+
+	pthread_mutex_lock(&s.lock);
+	s.counts[count] += n;
+	pthread_mutex_unlock(&s.lock);
+}
+
+/* Record how long the parser took over a page */
+void
+stats_parser(uint64_t ns)
+{
+	uint64_t us = ns / 1000;
+	size_t i;
+
+	if (!s.enabled) return;
+
+	for (i = 0; i < STATS_BUCKETS - 1 && us >= (UINT64_C(1) << i); ++i);
+	pthread_mutex_lock(&s.lock);
+	++s.buckets[i];
+	pthread_mutex_unlock(&s.lock);
+}
+
+/* Record how long a page took altogether, keeping the slowest */
+void
+stats_page(const char *path, uint64_t ns)
+{
+	size_t i;
+
+	if (!s.enabled) return;
+
+	pthread_mutex_lock(&s.lock);
+	for (i = s.slow_count; i > 0 && s.slowest[i - 1].ns < ns; --i);
+	if (i < STATS_SLOWEST) {
+		if (s.slow_count == STATS_SLOWEST) {
+			free(s.slowest[--s.slow_count].path);
+		}
+		memmove(&s.slowest[i + 1], &s.slowest[i],
+		    (s.slow_count - i) * sizeof(struct slow_page));
+		s.slowest[i].path = xstrdup(path);
+		s.slowest[i].ns = ns;
+		++s.slow_count;
+	}
+	pthread_mutex_unlock(&s.lock);
+}
+
+static void
+json_string(FILE *fp, const char *str)
+{
+	fputc('"', fp);
+	for (; *str != '\0'; ++str) {
+		unsigned char c = (unsigned char)*str;
+
+		if (c == '"' || c == '\\') {
+			fprintf(fp, "\\%c", c);
+		} else if (c < 0x20) {
+			fprintf(fp, "\\u%04x", c);
+		} else {
+			fputc(c, fp);
+		}
+	}
+	fputc('"', fp);
+}
+
+static void
+report_json(FILE *fp, uint64_t total)
+{
+	bool first = true;
+
+	fprintf(fp, "{\n\t\"seconds\": {\n");
+	for (size_t i = 0; i < STATS_PHASES; ++i) {
+		fprintf(fp, "\t\t\"%s\": %.6f,\n", phase_names[i],
+		    (double)s.phases[i] / 1e9);
+	}
+	fprintf(fp, "\t\t\"total\": %.6f\n\t},\n", (double)total / 1e9);
+
+	for (size_t i = 0; i < STATS_COUNTS; ++i) {
+		fprintf(fp, "\t\"%s\": %llu,\n", count_names[i],
+		    (unsigned long long)s.counts[i]);
+	}
+
+	fprintf(fp, "\t\"parser_latency\": [");
+	for (size_t i = 0; i < STATS_BUCKETS; ++i) {
+		if (s.buckets[i] == 0) continue;
+		fprintf(fp, "%s\n\t\t{ \"below_us\": %llu, \"count\": %llu }",
+		    first ? "" : ",", 1ULL << i,
+		    (unsigned long long)s.buckets[i]);
+		first = false;
+	}
+	fprintf(fp, "%s],\n", first ? "" : "\n\t");
+
+	fprintf(fp, "\t\"slowest\": [");
+	for (size_t i = 0; i < s.slow_count; ++i) {
+		fprintf(fp, "%s\n\t\t{ \"path\": ", i == 0 ? "" : ",");
+		json_string(fp, s.slowest[i].path);
+		fprintf(fp, ", \"seconds\": %.6f }",
+		    (double)s.slowest[i].ns / 1e9);
+	}
+	fprintf(fp, "%s]\n}\n", s.slow_count == 0 ? "" : "\n\t");
+}
+
+static void
+report_text(FILE *fp, uint64_t total)
+{
+	fprintf(fp, "%-16s %10s\n", "phase", "seconds");
+	for (size_t i = 0; i < STATS_PHASES; ++i) {
+		fprintf(fp, "%-16s %10.3f%s\n", phase_names[i],
+		    (double)s.phases[i] / 1e9,
+		    i == STATS_PARSE || i == STATS_TEMPLATE ||
+		    i == STATS_WRITE || i == STATS_TOKENIZE ?
+		    " (all pages)" : "");
+	}
+	fprintf(fp, "%-16s %10.3f\n\n", "total", (double)total / 1e9);
+
+	for (size_t i = 0; i < STATS_COUNTS; ++i) {
+		fprintf(fp, "%-16s %10llu\n", count_names[i],
+		    (unsigned long long)s.counts[i]);
+	}
+
+	fprintf(fp, "\nparser latency\n");
+	for (size_t i = 0; i < STATS_BUCKETS; ++i) {
+		if (s.buckets[i] == 0) continue;
+		fprintf(fp, "  < %10llu us %10llu\n", 1ULL << i,
+		    (unsigned long long)s.buckets[i]);
+	}
+
+	fprintf(fp, "\nslowest pages\n");
+	for (size_t i = 0; i < s.slow_count; ++i) {
+		fprintf(fp, "%10.3f ms  %s\n", (double)s.slowest[i].ns / 1e6,
+		    s.slowest[i].path);
+	}
+}
+
+/* Print what has been recorded since the last reset */
+int
+stats_report(FILE *fp, bool json)
+{
+	uint64_t total;
+
+	if (!s.enabled) return 0;
+
+	total = now_ns() - s.start;
+	pthread_mutex_lock(&s.lock);
+	if (json) {
+		report_json(fp, total);
+	} else {
+		report_text(fp, total);
+	}
+	pthread_mutex_unlock(&s.lock);
+	if (fflush(fp) == EOF) {
+		perror("fflush");
+		return -1;
+	}
+	return 0;
+}
+
+void
+stats_reset(void)
+{
+	pthread_mutex_lock(&s.lock);
+	for (size_t i = 0; i < s.slow_count; ++i) {
+		free(s.slowest[i].path);
+	}
+	memset(s.phases, 0, sizeof(s.phases));
+	memset(s.counts, 0, sizeof(s.counts));
+	memset(s.buckets, 0, sizeof(s.buckets));
+	s.slow_count = 0;
+	s.start = now_ns();
+	pthread_mutex_unlock(&s.lock);
+}
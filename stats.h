@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2015 Scarletts <scarlett@entering.space>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+enum stats_phase {
+	STATS_WALK,
+	STATS_DATES,
+	STATS_PARSE,
+	STATS_TEMPLATE,
+	STATS_WRITE,
+	STATS_TOKENIZE,
+	STATS_SORT,
+	STATS_ARCHIVE,
+	STATS_NEWS,
+	STATS_FEED,
+	STATS_SEARCH,
+	STATS_PHASES
+};
+
+enum stats_count {
+	STATS_PAGES,		/* rendered, not those left alone */
+	STATS_PROCESSES,
+	STATS_READ,		/* bytes */
+	STATS_WRITTEN,
+	STATS_COUNTS
+};
+
+void stats_enable(void);
+
+uint64_t stats_now(void);
+
+void stats_time(enum stats_phase, uint64_t);
+
+void stats_add(enum stats_count, uint64_t);
+
+void stats_parser(uint64_t);
+
+void stats_page(const char *, uint64_t);
+
+int stats_report(FILE *, bool);
+
+void stats_reset(void);
+
+#endif
@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2015 Scarletts <scarlett@entering.space>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "xalloc.h"
+#include "buf.h"
+#include "util.h"
+#include "template.h"
+
+static const char *tvar_names[TV_COUNT] = {
+	[TV_BASE_URL] = "${base_url}",
+	[TV_YEAR] = "${year}",
+	[TV_CREATED] = "${created}",
+	[TV_CREATED_READABLE] = "${created_readable}",
+	[TV_MODIFIED] = "${modified}",
+	[TV_MODIFIED_READABLE] = "${modified_readable}",
+	[TV_OWNER] = "${owner}",
+	[TV_TITLE] = "${title}",
+};
+
+static void
+add_seg(struct template *t, size_t *bufsize, const char *str, size_t len,
+    enum tvar var)
+{
+	if (str != NULL && len == 0) return;
+
+	if (t->seg_count >= *bufsize) {
+		*bufsize = *bufsize == 0 ? 16 : *bufsize * 2;
+		t->segs = xreallocarray(t->segs, *bufsize,
+		    sizeof(struct template_seg));
+	}
+	t->segs[t->seg_count].str = str;
+	t->segs[t->seg_count].len = len;
+	t->segs[t->seg_count].var = var;
+	++t->seg_count;
+}
+
+/*
+ * Compile a template into a list of literal spans and variable slots, so
+ * each page only needs the spans copied and the values filled in.
+ */
+int
+template_load(struct template *t, const char *path)
+{
+	size_t len;
+	size_t bufsize = 0;
+	const char *p, *lit, *end;
+
+	memset(t, 0, sizeof(struct template));
+
+	if ((t->text = read_file(path, &len)) == NULL) {
+		return -1;
+	}
+
+	end = t->text + len;
+	for (lit = p = t->text; p < end; ++p) {
+		enum tvar v;
+
+		if (*p != '$' || p + 1 >= end || *(p + 1) != '{') continue;
+
+		for (v = 0; v < TV_COUNT; ++v) {
+			size_t n = strlen(tvar_names[v]);
+
+			if ((size_t)(end - p) >= n &&
+			    memcmp(p, tvar_names[v], n) == 0) {
+				add_seg(t, &bufsize, lit, (size_t)(p - lit), 0);
+				add_seg(t, &bufsize, NULL, 0, v);
+				lit = p + n;
+				p = lit - 1;
+				break;
+			}
+		}
+	}
+	add_seg(t, &bufsize, lit, (size_t)(end - lit), 0);
+	return 0;
+}
+
+/*
+ * Expand a compiled template onto the end of out, vars holds the value of
+ * each variable.
+ */
+void
+template_expand(const struct template *t, const char *vars[TV_COUNT],
+    struct buf *out)
+{
+	size_t vlen[TV_COUNT];
+	size_t len = 0;
+	char *p;
+
+	for (size_t i = 0; i < TV_COUNT; ++i) {
+		vlen[i] = vars[i] != NULL ? strlen(vars[i]) : 0;
+	}
+	for (size_t i = 0; i < t->seg_count; ++i) {
+		const struct template_seg *s = &t->segs[i];
+
+		len += s->str != NULL ? s->len : vlen[s->var];
+	}
+
+	buf_reserve(out, len);
+	p = out->data + out->len;
+	for (size_t i = 0; i < t->seg_count; ++i) {
+		const struct template_seg *s = &t->segs[i];
+
+		if (s->str != NULL) {
+			memcpy(p, s->str, s->len);
+			p += s->len;
+		} else if (vlen[s->var] != 0) {
+			memcpy(p, vars[s->var], vlen[s->var]);
+			p += vlen[s->var];
+		}
+	}
+	*p = '\0';
+	out->len += len;
+}
+
+void
+template_free(struct template *t)
+{
+	free(t->text);
+	free(t->segs);
+	memset(t, 0, sizeof(struct template));
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2015 Scarletts <scarlett@entering.space>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef TEMPLATE_H
+#define TEMPLATE_H
+#include <stddef.h>
+
+#include "buf.h"
+
+/* Variables which may appear as ${name} in header.html and footer.html */
+enum tvar {
+	TV_BASE_URL,
+	TV_YEAR,
+	TV_CREATED,
+	TV_CREATED_READABLE,
+	TV_MODIFIED,
+	TV_MODIFIED_READABLE,
+	TV_OWNER,
+	TV_TITLE,
+	TV_COUNT
+};
+
+struct template_seg {
+	const char *str;	/* literal text, or NULL for a variable */
+	size_t len;
+	enum tvar var;
+};
+
+struct template {
+	char *text;
+	struct template_seg *segs;
+	size_t seg_count;
+};
+
+int template_load(struct template *, const char *);
+
+void template_expand(const struct template *, const char *[TV_COUNT],
+    struct buf *);
+
+void template_free(struct template *);
+
+#endif
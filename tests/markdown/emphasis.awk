@@ -0,0 +1,18 @@
+# Openers with nothing to close them, and runs nested no deeper than that
+BEGIN {
+	for (i = 0; i < 100000; i++) printf "*a ";
+	printf "\n\n";
+	for (i = 0; i < 100000; i++) printf "_a ";
+	printf "\n\n";
+	for (i = 0; i < 50000; i++) printf "*a _";
+	printf "b";
+	for (i = 0; i < 50000; i++) printf "_ a*";
+	printf "\n\n";
+	for (i = 0; i < 100000; i++) printf "` ";
+	printf "\n\n";
+	for (i = 1; i <= 400; i++) {
+		for (j = 0; j < i; j++) printf "`";
+		printf " *a ";
+	}
+	printf "\n";
+}
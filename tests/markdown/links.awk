@@ -0,0 +1,21 @@
+# Brackets nested deep, or never closed, and links which never end
+BEGIN {
+	for (i = 0; i < 100000; i++) printf "[";
+	printf "a";
+	for (i = 0; i < 100000; i++) printf "](b)";
+	printf "\n\n";
+	for (i = 0; i < 100000; i++) printf "[a ";
+	printf "]\n\n";
+	for (i = 0; i < 100000; i++) printf "[a](b";
+	printf "\n\n";
+	for (i = 0; i < 100000; i++) printf "[a](<b ";
+	printf "\n\n";
+	for (i = 0; i < 100000; i++) printf "[a](b (x ";
+	printf "\n\n";
+	for (i = 0; i < 100000; i++) printf "[a](b \"x ";
+	printf "\"\n\n";
+	for (i = 0; i < 100000; i++) printf "<a ";
+	printf "\n\n";
+	for (i = 0; i < 100000; i++) printf "<!x ";
+	printf "\n";
+}
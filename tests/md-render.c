@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2015 Scarletts <scarlett@entering.space>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Renders the markdown on stdin to stdout, as -m would a page's body, for
+ * checking against the expected output in tests/markdown.
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "../buf.h"
+#include "../util.h"
+#include "../markdown.h"
+
+int
+main(void)
+{
+	struct markdown md = {0};
+	struct buf out = {0};
+	char *src;
+	size_t len;
+	int ret = 0;
+
+	if ((src = fdread_fully(STDIN_FILENO, 0, &len)) == NULL) {
+		return 1;
+	}
+	markdown_render(&md, src, len, &out);
+	if (write_fully(STDOUT_FILENO, out.data, out.len) == -1) {
+		ret = 1;
+	}
+
+	free(src);
+	buf_free(&out);
+	markdown_free(&md);
+	return ret;
+}
@@ -14,100 +14,218 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
-#include <sys/wait.h>
+#ifdef __linux__
+#define _GNU_SOURCE	/* mkostemp() */
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <errno.h>
+#include <time.h>
 
 #include "xalloc.h"
+#include "buf.h"
 #include "util.h"
 
+/*
+ * Read until the end of the file. hint is how big it is expected to be, if
+ * known, so that a regular file can be read into a buffer of the right
+ * size straight away; anything else is read in ever larger pieces.
+ */
 char *
-fdread_fully(int fd, size_t *out_size)
+fdread_fully(int fd, size_t hint, size_t *out_size)
 {
-	ssize_t ret = 1;
-	char *buf = xmalloc(4096);
-	size_t bufsize = 4096;
-	size_t count = 0;
-
-	while (ret != 0) {
-		if (bufsize <= (count + 1024)) {
-			bufsize = count + 4096;
-			buf = xrealloc(buf, bufsize);
+	struct buf b;
+	ssize_t ret;
+
+	/* one spare byte, so reaching the end doesn't need more room */
+	buf_init(&b, hint + 1);
+
+	for (;;) {
+		if (b.size - b.len - 1 == 0) {
+			buf_reserve(&b, 65536);
 		}
-		ret = read(fd, buf + count, 1024);
+		ret = read(fd, b.data + b.len, b.size - b.len - 1);
 		if (ret == -1) {
+			if (errno == EINTR) continue;
 			perror("read");
-			goto error;
+			buf_free(&b);
+			return NULL;
 		}
-		count += (size_t)ret;
+		if (ret == 0) break;
+		b.len += (size_t)ret;
 	}
 
-	if (out_size != NULL) {
-		*out_size = count;
+	b.data[b.len] = '\0';
+	return buf_detach(&b, out_size);
+}
+
+char *
+read_file(const char *path, size_t *out_size)
+{
+	int fd;
+	char *buf;
+	struct stat st;
+
+	if ((fd = open(path, O_RDONLY)) == -1) {
+		perror(path);
+		return NULL;
 	}
-	buf[count] = '\0';
+	if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+		st.st_size = 0;
+	}
+	buf = fdread_fully(fd, (size_t)st.st_size, out_size);
+	close(fd);
 	return buf;
-error:
-	free(buf);
-	return NULL;
 }
 
+/*
+ * Map a file rather than reading it when possible. The rest of the last
+ * page of a mapping reads as zeroes, which terminates the string for
+ * free; if there is no rest, it is read instead. If *map_len is set on
+ * return, the result must be given back with unmap_file(), otherwise
+ * freed (which unmap_file() also does).
+ */
 char *
-strip_extension(char *filename)
+fdmap_file(int fd, size_t *out_size, size_t *map_len)
 {
-	char *p;
+	struct stat st;
+	char *data;
+	long pagesize = sysconf(_SC_PAGESIZE);
 
-	for (p = filename; *p != '\0'; ++p);
-	for (; p >= filename; --p) {
-		if (*p == '.') {
-			*p = '\0';
-			break;
+	*map_len = 0;
+	if (fstat(fd, &st) == -1) {
+		perror("fstat");
+		return NULL;
+	}
+	if (!S_ISREG(st.st_mode)) {
+		return fdread_fully(fd, 0, out_size);
+	}
+
+	if (st.st_size > 0 && pagesize > 0 && st.st_size % pagesize != 0) {
+		data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE,
+		    fd, 0);
+		if (data != MAP_FAILED) {
+			*map_len = (size_t)st.st_size;
+			if (out_size != NULL) {
+				*out_size = (size_t)st.st_size;
+			}
+			return data;
 		}
 	}
-	return filename;
+	return fdread_fully(fd, (size_t)st.st_size, out_size);
 }
 
 char *
-read_pipe(char *args[], size_t *out_len)
+map_file(const char *path, size_t *out_size, size_t *map_len)
 {
-	int status = 1;
-	int child_pipe[2];
-	char *output;
-	pid_t pid;
+	int fd;
+	char *data;
 
-	if (pipe(child_pipe) == -1) {
-		perror("pipe");
+	if ((fd = open(path, O_RDONLY)) == -1) {
+		perror(path);
 		return NULL;
 	}
+	data = fdmap_file(fd, out_size, map_len);
+	close(fd);
+	return data;
+}
 
-	pid = fork();
-	switch (pid) {
-		case -1:
-			perror("fork");
-			return NULL;
-		case 0:
-			close(child_pipe[0]);
-			dup2(child_pipe[1], STDOUT_FILENO);
-			execvp(args[0], args);
-			perror("execvp");
-			exit(1);
-			break;
+void
+unmap_file(char *data, size_t map_len)
+{
+	if (map_len != 0) {
+		munmap(data, map_len);
+	} else {
+		free(data);
 	}
+}
 
-	close(child_pipe[1]);
-	if (waitpid(pid, &status, 0) == -1) {
-		perror("wait");
-		return NULL;
+int
+write_fully(int fd, const void *data, size_t len)
+{
+	const char *p = data;
+	ssize_t ret;
+
+	while (len > 0) {
+		if ((ret = write(fd, p, len)) == -1) {
+			if (errno == EINTR) continue;
+			perror("write");
+			return -1;
+		}
+		p += ret;
+		len -= (size_t)ret;
 	}
-	if (status != 0) {
-		fprintf(stderr,
-		    "read_pipe: child %s process terminated unsuccessfully\n",
-		    args[0]);
-		return NULL;
+	return 0;
+}
+
+int
+read_fully(int fd, void *data, size_t len)
+{
+	char *p = data;
+	ssize_t ret;
+
+	while (len > 0) {
+		if ((ret = read(fd, p, len)) == -1) {
+			if (errno == EINTR) continue;
+			perror("read");
+			return -1;
+		}
+		if (ret == 0) {
+			fprintf(stderr, "read_fully: unexpected end of file\n");
+			return -1;
+		}
+		p += ret;
+		len -= (size_t)ret;
+	}
+	return 0;
+}
+
+/*
+ * Like mkstemp(), but the descriptor isn't inherited by parsers, which
+ * may be started by another thread at any moment.
+ */
+int
+make_temp(char *template)
+{
+#ifdef __linux__
+	return mkostemp(template, O_CLOEXEC);
+#else
+	int fd;
+
+	if ((fd = mkstemp(template)) != -1) {
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+	}
+	return fd;
+#endif
+}
+
+char *
+strip_extension(char *filename)
+{
+	char *p;
+
+	for (p = filename; *p != '\0'; ++p);
+	for (; p >= filename; --p) {
+		if (*p == '.') {
+			*p = '\0';
+			break;
+		}
 	}
-	output = fdread_fully(child_pipe[0], out_len);
-	close(child_pipe[0]);
-	return output;
+	return filename;
 }
 
+/* Nanoseconds on the monotonic clock, for measuring how long things take */
+uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
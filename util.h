@@ -17,12 +17,27 @@
 #ifndef UTIL_H
 #define UTIL_H
 #include <stddef.h>
+#include <stdint.h>
 
-char *fdread_fully(int, size_t *);
+char *fdread_fully(int, size_t, size_t *);
+
+char *read_file(const char *, size_t *);
+
+char *fdmap_file(int, size_t *, size_t *);
+
+char *map_file(const char *, size_t *, size_t *);
+
+void unmap_file(char *, size_t);
+
+int write_fully(int, const void *, size_t);
+
+int read_fully(int, void *, size_t);
+
+int make_temp(char *);
 
 char *strip_extension(char *);
 
-char *read_pipe(char **, size_t *);
+uint64_t now_ns(void);
 
 #endif
 
@@ -0,0 +1,519 @@
+/*
+ * Copyright (c) 2015 Scarletts <scarlett@entering.space>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Lists everything under a directory. Each directory is read through its
+ * own descriptor, and what is in it looked up relative to that, so the
+ * kernel never has to resolve a full path; the path is only kept in one
+ * buffer per thread, to be copied for each file found.
+ *
+ * With more than one thread, subdirectories are queued as they are found
+ * for whichever thread is free, so sibling subtrees are scanned at once.
+ * Each queued directory holds a descriptor open, so once too many are
+ * waiting, a thread scans the next one itself instead.
+ *
+ * Links are followed, so a link to a directory above it would go on
+ * forever; each directory carries the identities of those above it, and
+ * one which is among them is skipped with a warning. Being decided by the
+ * path alone, this doesn't depend on which thread gets somewhere first.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE	/* getdents64() */
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+
+#include "xalloc.h"
+#include "buf.h"
+#include "walk.h"
+
+#define WALK_PENDING	64
+#define WALK_DENTS	32768
+
+/* A directory, as it is seen from any path leading to it */
+struct dir_id {
+	dev_t dev;
+	ino_t ino;
+};
+
+/* The directories from the root down to the one being scanned */
+struct dir_ids {
+	struct dir_id *ids;
+	size_t count;
+	size_t bufsize;
+};
+
+struct pending {
+	int fd;
+	char *path;
+	struct dir_id *ids;
+	size_t depth;
+};
+
+struct walker {
+	size_t root_len;
+	bool threaded;
+	struct pending *queue;
+	size_t queued;
+	size_t busy;
+	bool failed;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+struct walk_thread {
+	pthread_t thread;
+	struct walker *walker;
+	struct walk out;
+	int ret;
+};
+
+/* Reads the names in a directory, with getdents64() where there is one */
+struct dir_reader {
+#ifdef __linux__
+	int fd;
+	char *buf;
+	size_t len;
+	size_t off;
+#else
+	DIR *dir;
+#endif
+};
+
+static int
+dir_open(struct dir_reader *r, int fd)
+{
+#ifdef __linux__
+	r->fd = fd;
+	r->buf = xmalloc(WALK_DENTS);
+	r->len = 0;
+	r->off = 0;
+	return 0;
+#else
+	int dfd;
+
+	/* closedir() closes the descriptor, but the caller still owns fd */
+	if ((dfd = dup(fd)) == -1) {
+		perror("dup");
+		return -1;
+	}
+	if ((r->dir = fdopendir(dfd)) == NULL) {
+		perror("fdopendir");
+		close(dfd);
+		return -1;
+	}
+	return 0;
+#endif
+}
+
+/* Returns NULL at the end, or with errno set on failure */
+static const char *
+dir_next(struct dir_reader *r)
+{
+#ifdef __linux__
+	struct dirent64 *de;
+	ssize_t ret;
+
+	if (r->off >= r->len) {
+		if ((ret = getdents64(r->fd, r->buf, WALK_DENTS)) <= 0) {
+			if (ret == 0) errno = 0;
+			return NULL;
+		}
+		r->len = (size_t)ret;
+		r->off = 0;
+	}
+	de = (struct dirent64 *)(r->buf + r->off);
+	r->off += de->d_reclen;
+	return de->d_name;
+#else
+	struct dirent *de;
+
+	errno = 0;
+	de = readdir(r->dir);
+	return de != NULL ? de->d_name : NULL;
+#endif
+}
+
+static void
+dir_close(struct dir_reader *r)
+{
+#ifdef __linux__
+	free(r->buf);
+#else
+	closedir(r->dir);
+#endif
+}
+
+static void
+add_file(struct walk *out, const char *path, size_t root_len,
+    const struct stat *st)
+{
+	struct walk_file *f;
+
+	if (out->count >= out->bufsize) {
+		out->bufsize = out->bufsize == 0 ? 64 : out->bufsize * 2;
+		out->files = xreallocarray(out->files, out->bufsize,
+		    sizeof(struct walk_file));
+	}
+	f = &out->files[out->count++];
+	f->path = xstrdup(path);
+	f->rel = f->path + root_len + 1;
+	f->st = *st;
+}
+
+static void
+add_dir(struct walk *out, const char *rel)
+{
+	if (out->dir_count >= out->dir_bufsize) {
+		out->dir_bufsize = out->dir_bufsize == 0 ?
+		    16 : out->dir_bufsize * 2;
+		out->dirs = xreallocarray(out->dirs, out->dir_bufsize,
+		    sizeof(char *));
+	}
+	out->dirs[out->dir_count++] = xstrdup(rel);
+}
+
+static void
+push_id(struct dir_ids *up, const struct stat *st)
+{
+	if (up->count >= up->bufsize) {
+		up->bufsize = up->bufsize == 0 ? 16 : up->bufsize * 2;
+		up->ids = xreallocarray(up->ids, up->bufsize,
+		    sizeof(struct dir_id));
+	}
+	up->ids[up->count].dev = st->st_dev;
+	up->ids[up->count].ino = st->st_ino;
+	++up->count;
+}
+
+static bool
+seen_above(const struct dir_ids *up, const struct stat *st)
+{
+	for (size_t i = 0; i < up->count; ++i) {
+		if (up->ids[i].dev == st->st_dev &&
+		    up->ids[i].ino == st->st_ino) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Hand a directory to another thread, if there is room in the queue */
+static bool
+queue_dir(struct walker *wk, int fd, const char *path,
+    const struct dir_ids *up)
+{
+	bool queued = false;
+	struct pending *d;
+
+	if (!wk->threaded) return false;
+
+	pthread_mutex_lock(&wk->lock);
+	if (wk->queued < WALK_PENDING) {
+		d = &wk->queue[wk->queued];
+		d->fd = fd;
+		d->path = xstrdup(path);
+		d->ids = xreallocarray(NULL, up->count, sizeof(struct dir_id));
+		memcpy(d->ids, up->ids, up->count * sizeof(struct dir_id));
+		d->depth = up->count;
+		++wk->queued;
+		pthread_cond_signal(&wk->cond);
+		queued = true;
+	}
+	pthread_mutex_unlock(&wk->lock);
+	return queued;
+}
+
+/*
+ * Scan the directory open as fd, whose path is in path, then close it. up
+ * holds it and the directories above it.
+ */
+static int
+scan_dir(struct walker *wk, struct walk *out, struct buf *path,
+    struct dir_ids *up, int fd)
+{
+	struct dir_reader r;
+	const char *name;
+	size_t len = path->len;
+	struct stat st;
+	int sub;
+	int ret = 0;
+
+	if (dir_open(&r, fd) == -1) {
+		close(fd);
+		return -1;
+	}
+
+	while ((name = dir_next(&r)) != NULL) {
+		if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+			continue;
+		}
+
+		path->len = len;
+		buf_appends(path, "/");
+		buf_appends(path, name);
+
+		/* like stat(), links are followed */
+		if (fstatat(fd, name, &st, 0) == -1) {
+			perror(path->data);
+			continue;
+		}
+		if (!S_ISDIR(st.st_mode)) {
+			add_file(out, path->data, wk->root_len, &st);
+			continue;
+		}
+
+		if (seen_above(up, &st)) {
+			fprintf(stderr, "%s: directory loop, not followed\n",
+			    path->data);
+			continue;
+		}
+
+		add_dir(out, path->data + wk->root_len + 1);
+		if ((sub = openat(fd, name, O_RDONLY | O_DIRECTORY)) == -1) {
+			perror(path->data);
+			ret = -1;
+			break;
+		}
+		push_id(up, &st);
+		if (!queue_dir(wk, sub, path->data, up) &&
+		    scan_dir(wk, out, path, up, sub) == -1) {
+			ret = -1;
+		}
+		--up->count;
+		if (ret == -1) break;
+	}
+	if (name == NULL && errno != 0) {
+		path->len = len;
+		path->data[len] = '\0';
+		perror(path->data);
+		ret = -1;
+	}
+
+	dir_close(&r);
+	close(fd);
+	path->len = len;
+	path->data[len] = '\0';
+	return ret;
+}
+
+static void *
+walk_worker(void *arg)
+{
+	struct walk_thread *t = arg;
+	struct walker *wk = t->walker;
+	struct pending d;
+	struct buf path = {0};
+	struct dir_ids up = {0};
+
+	pthread_mutex_lock(&wk->lock);
+	for (;;) {
+		while (wk->queued == 0 && wk->busy > 0 && !wk->failed) {
+			pthread_cond_wait(&wk->cond, &wk->lock);
+		}
+		if (wk->queued == 0 || wk->failed) break;
+
+		d = wk->queue[--wk->queued];
+		++wk->busy;
+		pthread_mutex_unlock(&wk->lock);
+
+		path.len = 0;
+		buf_appends(&path, d.path);
+		free(d.path);
+		free(up.ids);
+		up.ids = d.ids;
+		up.count = up.bufsize = d.depth;
+		if (scan_dir(wk, &t->out, &path, &up, d.fd) == -1) {
+			t->ret = -1;
+		}
+
+		pthread_mutex_lock(&wk->lock);
+		--wk->busy;
+		if (t->ret == -1) {
+			wk->failed = true;
+		}
+		if (wk->failed || (wk->busy == 0 && wk->queued == 0)) {
+			pthread_cond_broadcast(&wk->cond);
+		}
+	}
+	pthread_mutex_unlock(&wk->lock);
+
+	buf_free(&path);
+	free(up.ids);
+	return NULL;
+}
+
+static void
+merge(struct walk *out, struct walk *in)
+{
+	if (out->count + in->count > out->bufsize) {
+		out->bufsize = out->count + in->count;
+		out->files = xreallocarray(out->files, out->bufsize,
+		    sizeof(struct walk_file));
+	}
+	/* a thread which found nothing has no list to copy from */
+	if (in->count > 0) {
+		memcpy(out->files + out->count, in->files,
+		    in->count * sizeof(struct walk_file));
+	}
+	out->count += in->count;
+
+	if (out->dir_count + in->dir_count > out->dir_bufsize) {
+		out->dir_bufsize = out->dir_count + in->dir_count;
+		out->dirs = xreallocarray(out->dirs, out->dir_bufsize,
+		    sizeof(char *));
+	}
+	if (in->dir_count > 0) {
+		memcpy(out->dirs + out->dir_count, in->dirs,
+		    in->dir_count * sizeof(char *));
+	}
+	out->dir_count += in->dir_count;
+
+	free(in->files);
+	free(in->dirs);
+}
+
+static int
+compare_files(const void *v1, const void *v2)
+{
+	return strcmp(((const struct walk_file *)v1)->path,
+	    ((const struct walk_file *)v2)->path);
+}
+
+static int
+compare_dirs(const void *v1, const void *v2)
+{
+	return strcmp(*(char *const *)v1, *(char *const *)v2);
+}
+
+/*
+ * List everything under root into out, scanning with up to threads
+ * threads. The lists are sorted, so come out the same however many there
+ * are, and a directory always comes before what is in it.
+ */
+int
+walk_tree(struct walk *out, const char *root, size_t threads)
+{
+	struct walker wk = {0};
+	struct walk_thread *t = NULL;
+	struct buf path = {0};
+	struct dir_ids up = {0};
+	struct stat st;
+	size_t started = 0;
+	int fd;
+	int ret = 0;
+
+	memset(out, 0, sizeof(struct walk));
+	wk.root_len = strlen(root);
+
+	if ((fd = open(root, O_RDONLY | O_DIRECTORY)) == -1) {
+		perror(root);
+		return -1;
+	}
+	if (fstat(fd, &st) == -1) {
+		perror(root);
+		close(fd);
+		return -1;
+	}
+	push_id(&up, &st);
+
+	if (threads <= 1) {
+		buf_appends(&path, root);
+		ret = scan_dir(&wk, out, &path, &up, fd);
+		buf_free(&path);
+		free(up.ids);
+		goto sort;
+	}
+
+	wk.threaded = true;
+	wk.queue = xreallocarray(NULL, WALK_PENDING, sizeof(struct pending));
+	wk.queue[0].fd = fd;
+	wk.queue[0].path = xstrdup(root);
+	wk.queue[0].ids = up.ids;
+	wk.queue[0].depth = up.count;
+	wk.queued = 1;
+	pthread_mutex_init(&wk.lock, NULL);
+	pthread_cond_init(&wk.cond, NULL);
+
+	t = xreallocarray(NULL, threads, sizeof(struct walk_thread));
+	memset(t, 0, threads * sizeof(struct walk_thread));
+	for (; started < threads; ++started) {
+		t[started].walker = &wk;
+		if (pthread_create(&t[started].thread, NULL, walk_worker,
+		    &t[started]) != 0) {
+			perror("pthread_create");
+			break;
+		}
+	}
+	if (started == 0) {
+		/* do it all here instead */
+		walk_worker(&t[0]);
+		started = 1;
+	} else {
+		for (size_t i = 0; i < started; ++i) {
+			pthread_join(t[i].thread, NULL);
+		}
+	}
+
+	for (size_t i = 0; i < started; ++i) {
+		if (t[i].ret == -1) ret = -1;
+		merge(out, &t[i].out);
+	}
+	/* whatever is left after a failure */
+	for (size_t i = 0; i < wk.queued; ++i) {
+		close(wk.queue[i].fd);
+		free(wk.queue[i].path);
+		free(wk.queue[i].ids);
+	}
+	free(wk.queue);
+	free(t);
+	pthread_mutex_destroy(&wk.lock);
+	pthread_cond_destroy(&wk.cond);
+
+sort:
+	qsort(out->files, out->count, sizeof(struct walk_file),
+	    compare_files);
+	qsort(out->dirs, out->dir_count, sizeof(char *), compare_dirs);
+	if (ret == -1) {
+		walk_free(out);
+	}
+	return ret;
+}
+
+void
+walk_free(struct walk *w)
+{
+	for (size_t i = 0; i < w->count; ++i) {
+		free(w->files[i].path);
+	}
+	for (size_t i = 0; i < w->dir_count; ++i) {
+		free(w->dirs[i]);
+	}
+	free(w->files);
+	free(w->dirs);
+	memset(w, 0, sizeof(struct walk));
+}
@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2015 Scarletts <scarlett@entering.space>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef WALK_H
+#define WALK_H
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stddef.h>
+
+struct walk_file {
+	char *path;		/* starting with the root */
+	const char *rel;	/* the same, relative to the root */
+	struct stat st;
+};
+
+/* Everything under a directory, each list sorted by path */
+struct walk {
+	struct walk_file *files;
+	size_t count;
+	size_t bufsize;
+	char **dirs;		/* relative to the root, parents first */
+	size_t dir_count;
+	size_t dir_bufsize;
+};
+
+int walk_tree(struct walk *, const char *, size_t);
+
+void walk_free(struct walk *);
+
+#endif
@@ -0,0 +1,293 @@
+/*
+ * Copyright (c) 2015 Scarletts <scarlett@entering.space>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Watches the source tree and the templates, and turns what happens to
+ * them into a list of events for the pages. inotify only exists on Linux,
+ * elsewhere watch_open() just fails.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include "xalloc.h"
+#include "watch.h"
+
+#ifdef __linux__
+
+#define SRC_MASK (IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | \
+    IN_MOVED_TO | IN_ONLYDIR)
+#define TEMPLATE_MASK (IN_CLOSE_WRITE | IN_MOVED_TO | IN_ONLYDIR)
+
+/* Editors leave swap and backup files around, which aren't pages */
+static bool
+ignored(const char *name)
+{
+	size_t len = strlen(name);
+
+	if (name[0] == '.') return true;
+	if (len > 0 && name[len - 1] == '~') return true;
+	if (len >= sizeof(".date") - 1 &&
+	    strcmp(name + len - (sizeof(".date") - 1), ".date") == 0) {
+		return true;
+	}
+	return false;
+}
+
+static void
+add_event(struct watch *w, enum watch_type type, char *path)
+{
+	/* only the last thing that happened to a path matters */
+	for (size_t i = 0; i < w->event_count; ++i) {
+		if (strcmp(w->events[i].path, path) == 0) {
+			free(w->events[i].path);
+			memmove(&w->events[i], &w->events[i + 1],
+			    (w->event_count - i - 1) *
+			    sizeof(struct watch_event));
+			--w->event_count;
+			break;
+		}
+	}
+	if (w->event_count >= w->event_bufsize) {
+		w->event_bufsize = w->event_bufsize == 0 ?
+		    16 : w->event_bufsize * 2;
+		w->events = xreallocarray(w->events, w->event_bufsize,
+		    sizeof(struct watch_event));
+	}
+	w->events[w->event_count].type = type;
+	w->events[w->event_count].path = path;
+	++w->event_count;
+}
+
+/*
+ * Watch a directory and everything below it. Files found in it are
+ * reported as changed when report is set, since they may have been
+ * created before the watch was in place.
+ */
+static int
+watch_tree(struct watch *w, const char *dir, bool report)
+{
+	int wd;
+	DIR *d;
+	struct dirent *de;
+
+	if ((wd = inotify_add_watch(w->fd, dir, SRC_MASK)) == -1) {
+		perror(dir);
+		return -1;
+	}
+	if ((size_t)wd >= w->dirs_size) {
+		size_t old = w->dirs_size;
+
+		while ((size_t)wd >= w->dirs_size) {
+			w->dirs_size = w->dirs_size == 0 ?
+			    64 : w->dirs_size * 2;
+		}
+		w->dirs = xreallocarray(w->dirs, w->dirs_size,
+		    sizeof(char *));
+		memset(w->dirs + old, 0, (w->dirs_size - old) *
+		    sizeof(char *));
+	}
+	free(w->dirs[wd]);
+	w->dirs[wd] = xstrdup(dir);
+
+	if ((d = opendir(dir)) == NULL) {
+		perror(dir);
+		return -1;
+	}
+	while ((de = readdir(d)) != NULL) {
+		char *path = NULL;
+		struct stat st;
+
+		if (ignored(de->d_name)) continue;
+
+		xasprintf(&path, "%s/%s", dir, de->d_name);
+		if (stat(path, &st) == -1) {
+			free(path);
+			continue;
+		}
+		if (S_ISDIR(st.st_mode)) {
+			if (report) {
+				add_event(w, WATCH_DIR_ADDED, xstrdup(path));
+			}
+			if (watch_tree(w, path, report) == -1) {
+				free(path);
+				closedir(d);
+				return -1;
+			}
+			free(path);
+		} else if (report) {
+			add_event(w, WATCH_CHANGED, path);
+		} else {
+			free(path);
+		}
+	}
+	closedir(d);
+	return 0;
+}
+
+int
+watch_open(struct watch *w, const char *src)
+{
+	memset(w, 0, sizeof(struct watch));
+
+	if ((w->fd = inotify_init()) == -1) {
+		perror("inotify_init");
+		return -1;
+	}
+	/* the templates are often replaced rather than written to */
+	if (inotify_add_watch(w->fd, ".", TEMPLATE_MASK) == -1) {
+		perror("inotify_add_watch");
+		return -1;
+	}
+	return watch_tree(w, src, false);
+}
+
+static void
+handle(struct watch *w, const struct inotify_event *ev)
+{
+	char *path = NULL;
+
+	if (ev->len == 0 || ev->wd < 0 || (size_t)ev->wd >= w->dirs_size) {
+		return;
+	}
+
+	if (w->dirs[ev->wd] == NULL) {
+		/* the current directory, only the templates matter there */
+		if (strcmp(ev->name, "header.html") == 0 ||
+		    strcmp(ev->name, "footer.html") == 0) {
+			add_event(w, WATCH_TEMPLATE, xstrdup(ev->name));
+		}
+		return;
+	}
+
+	if (ignored(ev->name)) return;
+
+	xasprintf(&path, "%s/%s", w->dirs[ev->wd], ev->name);
+
+	if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+		add_event(w, WATCH_REMOVED, path);
+	} else if (ev->mask & IN_ISDIR) {
+		add_event(w, WATCH_DIR_ADDED, xstrdup(path));
+		watch_tree(w, path, true);
+		free(path);
+	} else if (ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+		add_event(w, WATCH_CHANGED, path);
+	} else {
+		/* IN_CREATE of a file, wait for it to be written */
+		free(path);
+	}
+}
+
+/*
+ * Wait for something to happen, then keep collecting events until
+ * things have been quiet for settle milliseconds, since saving a file
+ * often involves several steps.
+ */
+int
+watch_wait(struct watch *w, int settle)
+{
+	char buf[8192];
+	struct pollfd pfd;
+	int timeout = -1;
+
+	for (size_t i = 0; i < w->event_count; ++i) {
+		free(w->events[i].path);
+	}
+	w->event_count = 0;
+
+	pfd.fd = w->fd;
+	pfd.events = POLLIN;
+
+	for (;;) {
+		ssize_t len;
+		int ret;
+
+		if ((ret = poll(&pfd, 1, timeout)) == -1) {
+			if (errno == EINTR) continue;
+			perror("poll");
+			return -1;
+		}
+		if (ret == 0) {
+			if (w->event_count > 0) break;
+			timeout = -1;
+			continue;
+		}
+
+		if ((len = read(w->fd, buf, sizeof(buf))) == -1) {
+			if (errno == EINTR) continue;
+			perror("read");
+			return -1;
+		}
+		for (char *p = buf; p < buf + len;) {
+			const struct inotify_event *ev = (void *)p;
+
+			handle(w, ev);
+			p += sizeof(struct inotify_event) + ev->len;
+		}
+		timeout = settle;
+	}
+	return 0;
+}
+
+void
+watch_close(struct watch *w)
+{
+	for (size_t i = 0; i < w->event_count; ++i) {
+		free(w->events[i].path);
+	}
+	for (size_t i = 0; i < w->dirs_size; ++i) {
+		free(w->dirs[i]);
+	}
+	free(w->events);
+	free(w->dirs);
+	close(w->fd);
+	memset(w, 0, sizeof(struct watch));
+}
+
+#else
+
+int
+watch_open(struct watch *w, const char *src)
+{
+	memset(w, 0, sizeof(struct watch));
+	w->fd = -1;
+	fprintf(stderr, "watch_open: not supported on this system\n");
+	return -1;
+}
+
+int
+watch_wait(struct watch *w, int settle)
+{
+	return -1;
+}
+
+void
+watch_close(struct watch *w)
+{
+}
+
+#endif
@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2015 Scarletts <scarlett@entering.space>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef WATCH_H
+#define WATCH_H
+#include <stddef.h>
+
+enum watch_type {
+	WATCH_CHANGED,		/* a file was written or moved in */
+	WATCH_REMOVED,		/* a file or directory went away */
+	WATCH_DIR_ADDED,
+	WATCH_TEMPLATE
+};
+
+struct watch_event {
+	enum watch_type type;
+	char *path;
+};
+
+struct watch {
+	int fd;
+	char **dirs;		/* indexed by watch descriptor */
+	size_t dirs_size;
+	struct watch_event *events;
+	size_t event_count;
+	size_t event_bufsize;
+};
+
+int watch_open(struct watch *, const char *);
+
+int watch_wait(struct watch *, int);
+
+void watch_close(struct watch *);
+
+#endif
@@ -100,3 +100,109 @@ xasprintf(char **out, const char *fmt, ...)
 	return ret;
 }
 
+
+#define ARENA_CHUNK	65536
+
+/* everything handed out is aligned for any type this is used for */
+union arena_align {
+	long long ll;
+	long double ld;
+	void *p;
+	void (*fp)(void);
+};
+
+#define ARENA_ROUND(n) \
+	(((n) + sizeof(union arena_align) - 1) & \
+	~(sizeof(union arena_align) - 1))
+
+struct arena_chunk {
+	struct arena_chunk *next;
+	union arena_align data[];
+};
+
+void *
+arena_alloc(struct arena *a, size_t sz)
+{
+	struct arena_chunk *c;
+	size_t len;
+	void *ptr;
+
+	if (sz > SIZE_MAX - sizeof(union arena_align) - ARENA_CHUNK) {
+		fprintf(stderr, "arena_alloc: size will overflow\n");
+		exit(1);
+	}
+	sz = ARENA_ROUND(sz == 0 ? 1 : sz);
+
+	if (sz > a->left) {
+		/* big allocations get a chunk of their own */
+		len = sz > ARENA_CHUNK / 4 ? sz : ARENA_CHUNK;
+		c = xmalloc(sizeof(struct arena_chunk) + len);
+		if (len == ARENA_CHUNK || a->chunks == NULL) {
+			c->next = a->chunks;
+			a->chunks = c;
+			a->next = (char *)c->data;
+			a->left = len;
+		} else {
+			/* keep bumping through the current chunk */
+			c->next = a->chunks->next;
+			a->chunks->next = c;
+			return c->data;
+		}
+	}
+
+	ptr = a->next;
+	a->next += sz;
+	a->left -= sz;
+	return ptr;
+}
+
+char *
+arena_strdup(struct arena *a, const char *str)
+{
+	size_t len = strlen(str) + 1;
+
+	return memcpy(arena_alloc(a, len), str, len);
+}
+
+void
+arena_free(struct arena *a)
+{
+	struct arena_chunk *c;
+
+	while ((c = a->chunks) != NULL) {
+		a->chunks = c->next;
+		free(c);
+	}
+	a->next = NULL;
+	a->left = 0;
+}
+
+void
+pool_init(struct pool *p, struct arena *a, size_t sz)
+{
+	p->arena = a;
+	p->size = sz < sizeof(void *) ? sizeof(void *) : sz;
+	p->free = NULL;
+}
+
+/* Returns a zeroed object */
+void *
+pool_get(struct pool *p)
+{
+	void *ptr;
+
+	if (p->free != NULL) {
+		ptr = p->free;
+		p->free = *(void **)ptr;
+	} else {
+		ptr = arena_alloc(p->arena, p->size);
+	}
+	return memset(ptr, 0, p->size);
+}
+
+void
+pool_put(struct pool *p, void *ptr)
+{
+	*(void **)ptr = p->free;
+	p->free = ptr;
+}
@@ -29,5 +29,37 @@ char *xstrdup(const char *);
 
 int xasprintf(char **, const char *, ...);
 
+/*
+ * Memory which lives as long as the arena does: allocating from it is
+ * bumping a pointer, and it is all released at once by arena_free().
+ */
+struct arena {
+	struct arena_chunk *chunks;
+	char *next;
+	size_t left;
+};
+
+void *arena_alloc(struct arena *, size_t);
+
+char *arena_strdup(struct arena *, const char *);
+
+void arena_free(struct arena *);
+
+/*
+ * Objects of one size carved out of an arena, which never move. Those
+ * given back are reused before the arena is asked for more.
+ */
+struct pool {
+	struct arena *arena;
+	size_t size;
+	void *free;
+};
+
+void pool_init(struct pool *, struct arena *, size_t);
+
+void *pool_get(struct pool *);
+
+void pool_put(struct pool *, void *);
+
 #endif
 